@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "depthbuffer.h"
+#include "geometry.h"
+#include "gl.h"
+#include "raster.h"
+#include "tgaimage.h"
+
+namespace gl {
+// the same tiles as the depth buffer, so that a worker owns the depth tiles it draws to
+constexpr auto tile_size = DepthBuffer::tile_size;
+
+enum class Shading {
+    forward,  // fragment() runs for every pixel passing the depth test when its triangle is drawn
+    deferred, // depth prepass into a visibility buffer, then fragment() runs once per visible pixel
+};
+
+// Sorts triangles into tile_size x tile_size screen tiles, then rasterizes the tiles on worker threads.
+// Every tile is owned by exactly one worker, so the zbuffer and the framebuffer are written without locking.
+// Triangles are kept in submission order inside each bin, which gives the same image as drawing them one by one.
+// Payload is either a flat TGAColor or the Varying of the shader the bins are drawn with.
+template <typename Payload>
+class TileBinner {
+    struct Triangle {
+        TriangleSetup setup;
+        Payload       payload;
+    };
+
+    // visibility buffer entry of the deferred mode
+    struct Visible {
+        uint32_t   id;
+        vec3<Real> bc_clip;
+    };
+    static constexpr auto no_triangle = std::numeric_limits<uint32_t>::max();
+
+    int                                width;
+    int                                height;
+    int                                ntiles_x;
+    int                                ntiles_y;
+    std::vector<Triangle>              triangles = {};
+    std::vector<std::vector<uint32_t>> bins      = {};
+    std::vector<TriangleSetup>         setups    = {}; // scratch for push_screen
+
+    // calls draw_tile(bin, tile) for every non-empty tile, then clears the bins
+    template <typename F>
+    auto for_each_tile(const unsigned nthreads, F draw_tile) -> void {
+        auto next_tile = std::atomic<int>(0);
+        auto worker    = [&] {
+            for(auto i = next_tile++; i < int(bins.size()); i = next_tile++) {
+                const auto tx   = i % ntiles_x;
+                const auto ty   = i / ntiles_x;
+                const auto tile = Tile{{tx * tile_size, ty * tile_size},
+                                       {std::min(width, (tx + 1) * tile_size) - 1, std::min(height, (ty + 1) * tile_size) - 1}};
+                if(bins[i].empty()) continue;
+                draw_tile(bins[i], tile);
+            }
+        };
+        {
+            auto workers = std::vector<std::jthread>();
+            for(auto n = 1u; n < std::max(nthreads, 1u); n++) {
+                workers.emplace_back(worker);
+            }
+            worker();
+        }
+        clear();
+    }
+
+  public:
+    TileBinner(const int width, const int height)
+        : width(width), height(height), ntiles_x((width + tile_size - 1) / tile_size), ntiles_y((height + tile_size - 1) / tile_size), bins(ntiles_x * ntiles_y) {}
+
+    // t in clip coordinates
+    auto push(const std::array<vec4<Real>, 3>& t, const Payload& payload) -> void {
+        push_screen({gl::ViewPort * t[0], gl::ViewPort * t[1], gl::ViewPort * t[2]}, payload);
+    }
+
+    // t in screen coordinates, e.g. from transform_vertices()
+    auto push_screen(const std::array<vec4<Real>, 3>& t, const Payload& payload) -> void {
+        setups.clear();
+        setup_triangle(t, setups);
+        for(const auto& s : setups) {
+            if(s.bbmin.x >= width || s.bbmin.y >= height || s.bbmax.x < 0 || s.bbmax.y < 0) continue; // off-screen
+            const auto bbmin = Vec2i(std::max(s.bbmin.x, 0), std::max(s.bbmin.y, 0));
+            const auto bbmax = Vec2i(std::min(s.bbmax.x, width - 1), std::min(s.bbmax.y, height - 1));
+            const auto id    = uint32_t(triangles.size());
+            triangles.push_back({s, payload});
+            for(auto ty = bbmin.y / tile_size; ty <= bbmax.y / tile_size; ty++) {
+                for(auto tx = bbmin.x / tile_size; tx <= bbmax.x / tile_size; tx++) {
+                    bins[tx + ty * ntiles_x].push_back(id);
+                }
+            }
+        }
+    }
+
+    auto draw(DepthBuffer& zbuffer, TGAImage& image, const unsigned nthreads = std::thread::hardware_concurrency()) -> void
+        requires std::is_same_v<Payload, TGAColor>
+    {
+        for_each_tile(nthreads, [&](const std::vector<uint32_t>& bin, const Tile& tile) {
+            for(const auto id : bin) {
+                triangle(triangles[id].setup, zbuffer, image, triangles[id].payload, tile);
+            }
+        });
+    }
+
+    // With Shading::deferred the shader must not discard fragments: visibility is resolved before fragment() runs.
+    template <ShaderConcept T>
+        requires std::is_same_v<Payload, typename T::Varying>
+    auto draw(const T& shader, DepthBuffer& zbuffer, TGAImage& image, const Shading shading = Shading::forward, const unsigned nthreads = std::thread::hardware_concurrency()) -> void {
+        if(shading == Shading::forward) {
+            for_each_tile(nthreads, [&](const std::vector<uint32_t>& bin, const Tile& tile) {
+                for(const auto id : bin) {
+                    triangle(triangles[id].setup, shader, triangles[id].payload, zbuffer, image, tile);
+                }
+            });
+            return;
+        }
+        for_each_tile(nthreads, [&](const std::vector<uint32_t>& bin, const Tile& tile) {
+            // pass one: depth only, remembering which triangle won every pixel of the tile
+            thread_local auto visibility = std::vector<Visible>(tile_size * tile_size);
+            thread_local auto frags      = std::vector<Fragment>();
+            std::ranges::fill(visibility, Visible{no_triangle, {}});
+            for(const auto id : bin) {
+                frags.clear();
+                rasterize(triangles[id].setup, tile, zbuffer, true, frags);
+                for(const auto& f : frags) {
+                    visibility[(f.x - tile.bbmin.x) + (f.y - tile.bbmin.y) * tile_size] = {id, f.bc_clip};
+                }
+                update_blocks(zbuffer, frags);
+            }
+            // pass two: shade every visible pixel once
+            visit_pixels(image, [&](const auto pixels) {
+                for(auto y = tile.bbmin.y; y <= tile.bbmax.y; y++) {
+                    for(auto x = tile.bbmin.x; x <= tile.bbmax.x; x++) {
+                        const auto& v = visibility[(x - tile.bbmin.x) + (y - tile.bbmin.y) * tile_size];
+                        if(v.id == no_triangle) continue;
+                        auto color = PackedColor();
+                        if(shade(triangles[v.id].setup, shader, triangles[v.id].payload, x, y, v.bc_clip, color)) continue;
+                        pixels.set(x, y, color);
+                    }
+                }
+            });
+        });
+    }
+
+    auto clear() -> void {
+        triangles.clear();
+        for(auto& bin : bins) {
+            bin.clear();
+        }
+    }
+};
+} // namespace gl
@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "bvh.h"
+#include "meshcache.h"
+
+namespace {
+constexpr auto nbins          = 16;
+constexpr auto parallel_faces = 4096uz; // subtrees smaller than this are not worth a thread
+constexpr auto max_depth      = 64;     // of the traversal stacks
+constexpr auto sah_depth      = 28;     // deeper subtrees are halved, so that no tree is deeper than max_depth
+constexpr auto infinity       = std::numeric_limits<double>::infinity();
+
+struct Box {
+    Vec3d lo = {infinity, infinity, infinity};
+    Vec3d hi = {-infinity, -infinity, -infinity};
+
+    auto grow(const Vec3d p) -> void {
+        for(auto k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], p[k]);
+            hi[k] = std::max(hi[k], p[k]);
+        }
+    }
+    auto grow(const Box& b) -> void {
+        grow(b.lo);
+        grow(b.hi);
+    }
+    // half the surface area, 0 for an empty box
+    auto area() const -> double {
+        const auto d = hi - lo;
+        return d.x < 0 ? 0 : d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+};
+
+auto round_down(const double x) -> float {
+    const auto f = float(x);
+    return double(f) > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+auto round_up(const double x) -> float {
+    const auto f = float(x);
+    return double(f) < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+struct Builder {
+    std::vector<Box>   boxes;     // of every face
+    std::vector<Vec3d> centroids; // of the boxes
+    std::span<int>     faces;     // partitioned in place, every subtree sorts its own range
+
+    // Nodes of the subtree over faces[begin, end), its second children numbered from its root.
+    auto build(const size_t begin, const size_t end, const int depth, const unsigned nthreads) const -> std::vector<BvhNode> {
+        const auto n      = end - begin;
+        auto       bounds = Box();
+        auto       spread = Box(); // of the centroids
+        for(auto i = begin; i < end; i++) {
+            bounds.grow(boxes[faces[i]]);
+            spread.grow(centroids[faces[i]]);
+        }
+        auto nodes = std::vector<BvhNode>(1);
+        for(auto k = 0; k < 3; k++) {
+            nodes[0].lo[k] = round_down(bounds.lo[k]);
+            nodes[0].hi[k] = round_up(bounds.hi[k]);
+        }
+        nodes[0].first = uint32_t(begin);
+        nodes[0].count = uint32_t(n);
+        if(n <= 1) return nodes;
+
+        // cheapest split between two bins, costs relative to intersecting one face
+        auto best_cost = infinity;
+        auto best_axis = -1, best_bin = 0;
+        const auto bin = [&](const int f, const int axis) {
+            const auto extent = spread.hi[axis] - spread.lo[axis];
+            return std::min(nbins - 1, int((centroids[f][axis] - spread.lo[axis]) * nbins / extent));
+        };
+        for(auto axis = 0; axis < 3 && depth < sah_depth; axis++) {
+            if(!(spread.hi[axis] > spread.lo[axis])) continue;
+            auto count = std::array<size_t, nbins>();
+            auto box   = std::array<Box, nbins>();
+            for(auto i = begin; i < end; i++) {
+                const auto b = bin(faces[i], axis);
+                count[b]++;
+                box[b].grow(boxes[faces[i]]);
+            }
+            auto right      = std::array<double, nbins>(); // cost of the faces of bins b and above
+            auto accumulate = Box();
+            auto nright     = 0uz;
+            for(auto b = nbins - 1; b > 0; b--) {
+                accumulate.grow(box[b]);
+                nright += count[b];
+                right[b] = accumulate.area() * double(nright);
+            }
+            accumulate = Box();
+            auto nleft = 0uz;
+            for(auto b = 0; b < nbins - 1; b++) {
+                accumulate.grow(box[b]);
+                nleft += count[b];
+                if(nleft == 0 || nleft == n) continue;
+                const auto cost = accumulate.area() * double(nleft) + right[b + 1];
+                if(cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin  = b + 1;
+                }
+            }
+        }
+        // a traversal step costs about as much as a face
+        const auto area = bounds.area();
+        if(n <= bvh_max_leaf_faces && (best_axis < 0 || area * double(n) <= area + best_cost)) return nodes;
+        auto mid = begin + n / 2; // all centroids coincide or the tree is too deep
+        if(best_axis >= 0) {
+            const auto it = std::partition(faces.begin() + begin, faces.begin() + end, [&](const int f) { return bin(f, best_axis) < best_bin; });
+            mid           = size_t(it - faces.begin());
+        }
+
+        auto left  = std::vector<BvhNode>();
+        auto right = std::vector<BvhNode>();
+        if(nthreads > 1 && n >= parallel_faces) {
+            auto worker = std::jthread([&] { left = build(begin, mid, depth + 1, nthreads / 2); });
+            right       = build(mid, end, depth + 1, nthreads - nthreads / 2);
+        } else {
+            left  = build(begin, mid, depth + 1, 1);
+            right = build(mid, end, depth + 1, 1);
+        }
+        nodes[0].first = uint32_t(1 + left.size());
+        nodes[0].count = 0;
+        nodes.reserve(1 + left.size() + right.size());
+        for(auto* subtree : {&left, &right}) {
+            const auto offset = uint32_t(nodes.size());
+            for(auto node : *subtree) {
+                if(node.count == 0) node.first += offset;
+                nodes.push_back(node);
+            }
+        }
+        return nodes;
+    }
+};
+
+// Entry parameter of the ray into the box within [0, t_max], infinity if it misses. inverse is 1 / direction.
+auto enter(const BvhNode& node, const Vec3d origin, const Vec3d inverse, const double t_max) -> double {
+    auto t0 = 0.0, t1 = t_max;
+    for(auto k = 0; k < 3; k++) {
+        auto ta = (node.lo[k] - origin[k]) * inverse[k];
+        auto tb = (node.hi[k] - origin[k]) * inverse[k];
+        if(ta > tb) std::swap(ta, tb);
+        t0 = std::max(t0, ta); // NaN, for a ray in the plane of a side, leaves the bound as it is
+        t1 = std::min(t1, tb);
+    }
+    return t0 <= t1 ? t0 : infinity;
+}
+
+auto squared_distance(const BvhNode& node, const Vec3d p) -> double {
+    auto d = 0.0;
+    for(auto k = 0; k < 3; k++) {
+        const auto outside = std::max({node.lo[k] - p[k], 0.0, p[k] - node.hi[k]});
+        d += outside * outside;
+    }
+    return d;
+}
+
+// Moller-Trumbore, from either side; the ray parameter of the hit, negative if none
+auto intersect(const Ray& ray, const Vec3d a, const Vec3d b, const Vec3d c) -> double {
+    const auto e1  = b - a;
+    const auto e2  = c - a;
+    const auto p   = cross(ray.direction, e2);
+    const auto det = e1 * p;
+    if(det == 0) return -1;
+    const auto s = ray.origin - a;
+    const auto u = s * p / det;
+    if(u < 0 || u > 1) return -1;
+    const auto q = cross(s, e1);
+    const auto v = ray.direction * q / det;
+    if(v < 0 || u + v > 1) return -1;
+    return e2 * q / det;
+}
+
+// Closest point of the triangle to p, by its Voronoi regions (Ericson, Real-Time Collision Detection 5.1.5).
+auto closest_point(const Vec3d p, const Vec3d a, const Vec3d b, const Vec3d c) -> Vec3d {
+    const auto ab = b - a, ac = c - a, ap = p - a;
+    const auto d1 = ab * ap, d2 = ac * ap;
+    if(d1 <= 0 && d2 <= 0) return a;
+    const auto bp = p - b;
+    const auto d3 = ab * bp, d4 = ac * bp;
+    if(d3 >= 0 && d4 <= d3) return b;
+    const auto vc = d1 * d4 - d3 * d2;
+    if(vc <= 0 && d1 >= 0 && d3 <= 0) return a + ab * (d1 / (d1 - d3));
+    const auto cp = p - c;
+    const auto d5 = ab * cp, d6 = ac * cp;
+    if(d6 >= 0 && d5 <= d6) return c;
+    const auto vb = d5 * d2 - d1 * d6;
+    if(vb <= 0 && d2 >= 0 && d6 <= 0) return a + ac * (d2 / (d2 - d6));
+    const auto va = d3 * d6 - d5 * d4;
+    if(va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    const auto denom = 1 / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+} // namespace
+
+auto build_bvh(const std::span<const Vertex> vertices, const std::span<const int> indices, const unsigned nthreads) -> Bvh {
+    const auto nfaces = indices.size() / 3;
+    auto       bvh    = Bvh();
+    if(nfaces == 0) return bvh;
+    bvh.faces.resize(nfaces);
+    auto builder = Builder{std::vector<Box>(nfaces), std::vector<Vec3d>(nfaces), bvh.faces};
+    for(auto f = 0uz; f < nfaces; f++) {
+        bvh.faces[f] = int(f);
+        for(auto k = 0; k < 3; k++) {
+            builder.boxes[f].grow(vertices[indices[f * 3 + k]].pos);
+        }
+        builder.centroids[f] = (builder.boxes[f].lo + builder.boxes[f].hi) / 2;
+    }
+    bvh.nodes = builder.build(0, nfaces, 0, std::max(nthreads, 1u));
+    return bvh;
+}
+
+auto intersect(const Bvh& bvh, const std::span<const Vertex> vertices, const std::span<const int> indices, const Ray& ray, const double t_max) -> std::optional<BvhHit> {
+    if(bvh.empty()) return std::nullopt;
+    const auto inverse = Vec3d(1 / ray.direction.x, 1 / ray.direction.y, 1 / ray.direction.z);
+    auto       hit     = BvhHit{-1, t_max, {}};
+    auto       stack   = std::array<uint32_t, max_depth>();
+    auto       top     = 0;
+    if(enter(bvh.nodes[0], ray.origin, inverse, t_max) < infinity) stack[top++] = 0;
+    while(top > 0) {
+        const auto  i    = stack[--top];
+        const auto& node = bvh.nodes[i];
+        if(node.count > 0) {
+            for(auto j = node.first; j < node.first + node.count; j++) {
+                const auto f = bvh.faces[j];
+                const auto t = intersect(ray, vertices[indices[f * 3]].pos, vertices[indices[f * 3 + 1]].pos, vertices[indices[f * 3 + 2]].pos);
+                if(t >= 0 && t <= hit.t) hit = {f, t, {}};
+            }
+            continue;
+        }
+        // the nearer child is popped first, the farther one is skipped if a hit came before it
+        const auto first  = i + 1;
+        const auto second = node.first;
+        const auto t1     = enter(bvh.nodes[first], ray.origin, inverse, hit.t);
+        const auto t2     = enter(bvh.nodes[second], ray.origin, inverse, hit.t);
+        const auto near   = t1 <= t2 ? first : second;
+        const auto far    = t1 <= t2 ? second : first;
+        if(std::max(t1, t2) < infinity) stack[top++] = far;
+        if(std::min(t1, t2) < infinity) stack[top++] = near;
+    }
+    if(hit.face < 0) return std::nullopt;
+    hit.point = ray.origin + ray.direction * hit.t;
+    return hit;
+}
+
+auto nearest_face(const Bvh& bvh, const std::span<const Vertex> vertices, const std::span<const int> indices, const Vec3d p) -> std::optional<BvhHit> {
+    if(bvh.empty()) return std::nullopt;
+    auto hit     = BvhHit{-1, infinity, {}};
+    auto nearest = infinity; // squared distance of hit
+    auto stack   = std::array<uint32_t, max_depth>();
+    auto top     = 0;
+    stack[top++] = 0;
+    while(top > 0) {
+        const auto  i    = stack[--top];
+        const auto& node = bvh.nodes[i];
+        if(squared_distance(node, p) > nearest) continue;
+        if(node.count > 0) {
+            for(auto j = node.first; j < node.first + node.count; j++) {
+                const auto f = bvh.faces[j];
+                const auto q = closest_point(p, vertices[indices[f * 3]].pos, vertices[indices[f * 3 + 1]].pos, vertices[indices[f * 3 + 2]].pos);
+                const auto d = (q - p) * (q - p);
+                if(d < nearest || (d == nearest && f < hit.face)) {
+                    nearest = d;
+                    hit     = {f, 0, q};
+                }
+            }
+            continue;
+        }
+        const auto first  = i + 1;
+        const auto second = node.first;
+        const auto d1     = squared_distance(bvh.nodes[first], p);
+        const auto d2     = squared_distance(bvh.nodes[second], p);
+        stack[top++]      = d1 <= d2 ? second : first;
+        stack[top++]      = d1 <= d2 ? first : second;
+    }
+    hit.t = std::sqrt(nearest);
+    return hit;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "geometry.h"
+
+struct Vertex;
+
+// A node of a bounding volume hierarchy: an axis-aligned box in float, rounded outwards so that it still contains
+// its faces. Nodes are stored depth first, the first child of an inner node right after it.
+struct BvhNode {
+    float    lo[3];
+    uint32_t first; // leaf: first of its faces in Bvh::faces; inner node: index of its second child
+    float    hi[3];
+    uint32_t count; // faces of a leaf, 0 for an inner node
+};
+
+constexpr auto bvh_max_leaf_faces = 8;
+
+// Hierarchy over the faces of a mesh, the root is nodes[0]. The faces of every subtree are a range of faces.
+struct Bvh {
+    std::vector<BvhNode> nodes = {};
+    std::vector<int>     faces = {}; // face numbers, leaf by leaf
+
+    auto empty() const -> bool { return nodes.empty(); }
+};
+
+struct Ray {
+    Vec3d origin;
+    Vec3d direction; // need not be normalized
+};
+
+struct BvhHit {
+    int    face  = -1;
+    double t     = 0; // ray parameter of the hit, or distance to the nearest point
+    Vec3d  point = {};
+};
+
+// Builds the hierarchy with the surface area heuristic, evaluated over a few bins of face centroids per axis.
+// Large subtrees are built on up to nthreads threads; the result does not depend on nthreads.
+auto build_bvh(std::span<const Vertex> vertices, std::span<const int> indices, const unsigned nthreads = std::thread::hardware_concurrency()) -> Bvh;
+
+// Nearest intersection of the ray with a face for t in [0, t_max], from either side; nullopt if there is none.
+auto intersect(const Bvh& bvh, std::span<const Vertex> vertices, std::span<const int> indices, const Ray& ray, const double t_max = std::numeric_limits<double>::infinity()) -> std::optional<BvhHit>;
+// Point of the faces nearest to p; nullopt if the mesh has no faces.
+auto nearest_face(const Bvh& bvh, std::span<const Vertex> vertices, std::span<const int> indices, const Vec3d p) -> std::optional<BvhHit>;
@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <limits>
+
+#include "depthbuffer.h"
+
+namespace gl {
+DepthBuffer::DepthBuffer(const int width, const int height, const DepthFormat format, const Real far)
+    : width(width), height(height), ntiles_x((width + tile_size - 1) / tile_size), format(format), scale(format == DepthFormat::unorm24 ? unorm24_max / far : 1) {
+    const auto ntiles = size_t(ntiles_x) * ((height + tile_size - 1) / tile_size);
+    clear_key         = encode(std::numeric_limits<Real>::infinity());
+    keys.resize(ntiles * tile_size * tile_size);
+    zmax.resize(ntiles * blocks_per_tile * blocks_per_tile);
+    tile_generation.resize(ntiles, 0);
+}
+
+auto DepthBuffer::clear() -> void {
+    if(++generation == 0) { // wrapped around, a tile may still claim to be current
+        std::ranges::fill(tile_generation, 0);
+        generation = 1;
+    }
+}
+
+auto DepthBuffer::get(const int x, const int y) const -> Real {
+    const auto t = x / tile_size + y / tile_size * ntiles_x;
+    return decode(tile_generation[t] == generation ? keys[index(x, y)] : clear_key);
+}
+
+auto DepthBuffer::encode(const Real depth) const -> uint32_t {
+    return format == DepthFormat::float32 ? encode_depth<DepthFormat::float32>(depth, scale) : encode_depth<DepthFormat::unorm24>(depth, scale);
+}
+
+auto DepthBuffer::decode(const uint32_t key) const -> Real {
+    return format == DepthFormat::float32 ? Real(std::bit_cast<float>(key)) : Real(key) / scale;
+}
+
+auto DepthBuffer::operator==(const DepthBuffer& other) const -> bool {
+    if(width != other.width || height != other.height || format != other.format || scale != other.scale) return false;
+    for(auto y = 0; y < height; y++) {
+        for(auto x = 0; x < width; x++) {
+            if(get(x, y) != other.get(x, y)) return false;
+        }
+    }
+    return true;
+}
+
+auto DepthBuffer::tile(const int tx, const int ty) -> uint32_t* {
+    const auto t     = size_t(tx + ty * ntiles_x);
+    auto*      first = keys.data() + t * tile_size * tile_size;
+    if(tile_generation[t] != generation) {
+        std::fill_n(first, tile_size * tile_size, clear_key);
+        std::fill_n(zmax.data() + t * blocks_per_tile * blocks_per_tile, blocks_per_tile * blocks_per_tile, clear_key);
+        tile_generation[t] = generation;
+    }
+    return first;
+}
+
+auto DepthBuffer::update_block(const int bx, const int by) -> void {
+    auto       farthest = uint32_t(0);
+    const auto x1       = std::min(width, (bx + 1) * block_size);
+    const auto y1       = std::min(height, (by + 1) * block_size);
+    for(auto y = by * block_size; y < y1; y++) {
+        const auto* row = &keys[index(bx * block_size, y)];
+        for(auto x = 0; x < x1 - bx * block_size; x++) {
+            farthest = std::max(farthest, row[x]);
+        }
+    }
+    zmax[block_index(bx, by)] = farthest;
+}
+} // namespace gl
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "gl.h"
+
+namespace gl {
+enum class DepthFormat {
+    float32, // depths as 32-bit floats
+    unorm24, // depths in [0, far] as 24-bit fixed point
+};
+
+constexpr auto unorm24_max = Real((1 << 24) - 1);
+
+// Maps a depth to the 32-bit key it is stored as. Keys compare like the depths they encode, so the depth test is an
+// integer compare whatever the format: negative depths map to 0 and, for unorm24, depths beyond far to unorm24_max.
+template <DepthFormat F>
+inline auto encode_depth(const Real depth, const Real scale) -> uint32_t {
+    if constexpr(F == DepthFormat::float32) {
+        return std::bit_cast<uint32_t>(float(depth > 0 ? depth : 0));
+    } else {
+        auto x = depth * scale;
+        x      = x > 0 ? x : 0;
+        x      = x < unorm24_max ? x : unorm24_max;
+        return uint32_t(std::lrint(x));
+    }
+}
+
+// Depth buffer with 4 bytes per pixel, stored tile by tile so that a tile_size x tile_size screen tile is contiguous.
+// clear() is O(1): every tile remembers the generation it was last cleared in and is filled on first use after a clear.
+// It also keeps the farthest key of every block_size x block_size block (hierarchical z), which the rasterizer uses to
+// skip blocks a triangle is entirely behind. Depth writes only ever bring keys nearer, so the farthest key stays a valid
+// bound even where it has not been recomputed yet.
+class DepthBuffer {
+  public:
+    static constexpr auto tile_size  = 64;
+    static constexpr auto block_size = 8;
+
+    // far is the depth mapped to the largest unorm24 key, unused for float32
+    DepthBuffer(const int width, const int height, const DepthFormat format = DepthFormat::float32, const Real far = 100);
+    auto get_width() const -> int { return width; }
+    auto get_height() const -> int { return height; }
+    auto get_format() const -> DepthFormat { return format; }
+    auto get_scale() const -> Real { return scale; }
+    auto clear() -> void;
+    auto get(const int x, const int y) const -> Real;
+    auto encode(const Real depth) const -> uint32_t;
+    auto decode(const uint32_t key) const -> Real;
+    // same size, format and depths, however the tiles were cleared
+    auto operator==(const DepthBuffer& other) const -> bool;
+
+    // Keys of the tile holding pixel (tx * tile_size, ty * tile_size), clearing it first if needed.
+    // Not synchronized: a tile must be used by one thread at a time.
+    auto tile(const int tx, const int ty) -> uint32_t*;
+    // key of a pixel of a tile already returned by tile() since the last clear
+    auto key(const int x, const int y) -> uint32_t& { return keys[index(x, y)]; }
+    auto farthest(const int bx, const int by) const -> uint32_t { return zmax[block_index(bx, by)]; }
+    // recomputes the farthest key of a block of a tile already returned by tile() since the last clear
+    auto update_block(const int bx, const int by) -> void;
+
+  private:
+    static constexpr auto blocks_per_tile = tile_size / block_size;
+
+    int                   width;
+    int                   height;
+    int                   ntiles_x;
+    DepthFormat           format;
+    Real                  scale;
+    uint32_t              clear_key;
+    uint32_t              generation      = 1;
+    std::vector<uint32_t> keys            = {};
+    std::vector<uint32_t> zmax            = {};
+    std::vector<uint32_t> tile_generation = {};
+
+    auto index(const int x, const int y) const -> size_t {
+        const auto t = size_t(x / tile_size + y / tile_size * ntiles_x);
+        return t * tile_size * tile_size + x % tile_size + y % tile_size * tile_size;
+    }
+    auto block_index(const int bx, const int by) const -> size_t {
+        const auto t = size_t(bx / blocks_per_tile + by / blocks_per_tile * ntiles_x);
+        return t * blocks_per_tile * blocks_per_tile + bx % blocks_per_tile + by % blocks_per_tile * blocks_per_tile;
+    }
+};
+} // namespace gl
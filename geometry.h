@@ -147,48 +147,56 @@ inline vec3<T> cross(const vec3<T>& v1, const vec3<T>& v2) {
     return {v1.y * v2.z - v1.z * v2.y, v1.z * v2.x - v1.x * v2.z, v1.x * v2.y - v1.y * v2.x};
 }
 
-template <int n>
+template <Numeric U, Numeric T, int n>
+vec<U, n> vec_cast(const vec<T, n>& v) {
+    vec<U, n> ret;
+    for(int i = n; i--; ret[i] = U(v[i]))
+        ;
+    return ret;
+}
+
+template <int n, Numeric T = double>
 struct dt;
 
-template <int nrows, int ncols>
+template <int nrows, int ncols, Numeric T = double>
 struct mat {
-    vec<double, ncols> rows[nrows] = {{}};
+    vec<T, ncols> rows[nrows] = {{}};
 
-    vec<double, ncols>& operator[](const int idx) {
+    vec<T, ncols>& operator[](const int idx) {
         assert(idx >= 0 && idx < nrows);
         return rows[idx];
     }
-    const vec<double, ncols>& operator[](const int idx) const {
+    const vec<T, ncols>& operator[](const int idx) const {
         assert(idx >= 0 && idx < nrows);
         return rows[idx];
     }
 
-    double det() const {
-        return dt<ncols>::det(*this);
+    T det() const {
+        return dt<ncols, T>::det(*this);
     }
 
-    double cofactor(const int row, const int col) const {
-        mat<nrows - 1, ncols - 1> submatrix;
+    T cofactor(const int row, const int col) const {
+        mat<nrows - 1, ncols - 1, T> submatrix;
         for(int i = nrows - 1; i--;)
             for(int j = ncols - 1; j--; submatrix[i][j] = rows[i + int(i >= row)][j + int(j >= col)])
                 ;
         return submatrix.det() * ((row + col) % 2 ? -1 : 1);
     }
 
-    mat<nrows, ncols> invert_transpose() const {
-        mat<nrows, ncols> adjugate_transpose; // transpose to ease determinant computation, check the last line
+    mat<nrows, ncols, T> invert_transpose() const {
+        mat<nrows, ncols, T> adjugate_transpose; // transpose to ease determinant computation, check the last line
         for(int i = nrows; i--;)
             for(int j = ncols; j--; adjugate_transpose[i][j] = cofactor(i, j))
                 ;
         return adjugate_transpose / (adjugate_transpose[0] * rows[0]);
     }
 
-    mat<nrows, ncols> invert() const {
+    mat<nrows, ncols, T> invert() const {
         return invert_transpose().transpose();
     }
 
-    mat<ncols, nrows> transpose() const {
-        mat<ncols, nrows> ret;
+    mat<ncols, nrows, T> transpose() const {
+        mat<ncols, nrows, T> ret;
         for(int i = ncols; i--;)
             for(int j = nrows; j--; ret[i][j] = rows[j][i])
                 ;
@@ -196,22 +204,30 @@ struct mat {
     }
 };
 
+template <Numeric U, Numeric T, int nrows, int ncols>
+mat<nrows, ncols, U> mat_cast(const mat<nrows, ncols, T>& m) {
+    mat<nrows, ncols, U> ret;
+    for(int i = nrows; i--; ret[i] = vec_cast<U>(m[i]))
+        ;
+    return ret;
+}
+
 template <Numeric T, int nrows, int ncols>
-vec<T, ncols> operator*(const vec<T, nrows>& lhs, const mat<nrows, ncols>& rhs) {
-    return (mat<1, nrows>{{lhs}} * rhs)[0];
+vec<T, ncols> operator*(const vec<T, nrows>& lhs, const mat<nrows, ncols, T>& rhs) {
+    return (mat<1, nrows, T>{{lhs}} * rhs)[0];
 }
 
 template <Numeric T, int nrows, int ncols>
-vec<T, nrows> operator*(const mat<nrows, ncols>& lhs, const vec<T, ncols>& rhs) {
+vec<T, nrows> operator*(const mat<nrows, ncols, T>& lhs, const vec<T, ncols>& rhs) {
     vec<T, nrows> ret;
     for(int i = nrows; i--; ret[i] = lhs[i] * rhs)
         ;
     return ret;
 }
 
-template <int R1, int C1, int C2>
-mat<R1, C2> operator*(const mat<R1, C1>& lhs, const mat<C1, C2>& rhs) {
-    mat<R1, C2> result;
+template <int R1, int C1, int C2, Numeric T>
+mat<R1, C2, T> operator*(const mat<R1, C1, T>& lhs, const mat<C1, C2, T>& rhs) {
+    mat<R1, C2, T> result;
     for(int i = R1; i--;)
         for(int j = C2; j--;)
             for(int k = C1; k--; result[i][j] += lhs[i][k] * rhs[k][j])
@@ -219,60 +235,60 @@ mat<R1, C2> operator*(const mat<R1, C1>& lhs, const mat<C1, C2>& rhs) {
     return result;
 }
 
-template <int nrows, int ncols>
-mat<nrows, ncols> operator*(const mat<nrows, ncols>& lhs, const double& val) {
-    mat<nrows, ncols> result;
+template <int nrows, int ncols, Numeric T>
+mat<nrows, ncols, T> operator*(const mat<nrows, ncols, T>& lhs, const double& val) {
+    mat<nrows, ncols, T> result;
     for(int i = nrows; i--; result[i] = lhs[i] * val)
         ;
     return result;
 }
 
-template <int nrows, int ncols>
-mat<nrows, ncols> operator/(const mat<nrows, ncols>& lhs, const double& val) {
-    mat<nrows, ncols> result;
+template <int nrows, int ncols, Numeric T>
+mat<nrows, ncols, T> operator/(const mat<nrows, ncols, T>& lhs, const double& val) {
+    mat<nrows, ncols, T> result;
     for(int i = nrows; i--; result[i] = lhs[i] / val)
         ;
     return result;
 }
 
-template <int nrows, int ncols>
-mat<nrows, ncols> operator+(const mat<nrows, ncols>& lhs, const mat<nrows, ncols>& rhs) {
-    mat<nrows, ncols> result;
+template <int nrows, int ncols, Numeric T>
+mat<nrows, ncols, T> operator+(const mat<nrows, ncols, T>& lhs, const mat<nrows, ncols, T>& rhs) {
+    mat<nrows, ncols, T> result;
     for(int i = nrows; i--;)
         for(int j = ncols; j--; result[i][j] = lhs[i][j] + rhs[i][j])
             ;
     return result;
 }
 
-template <int nrows, int ncols>
-mat<nrows, ncols> operator-(const mat<nrows, ncols>& lhs, const mat<nrows, ncols>& rhs) {
-    mat<nrows, ncols> result;
+template <int nrows, int ncols, Numeric T>
+mat<nrows, ncols, T> operator-(const mat<nrows, ncols, T>& lhs, const mat<nrows, ncols, T>& rhs) {
+    mat<nrows, ncols, T> result;
     for(int i = nrows; i--;)
         for(int j = ncols; j--; result[i][j] = lhs[i][j] - rhs[i][j])
             ;
     return result;
 }
 
-template <int nrows, int ncols>
-std::ostream& operator<<(std::ostream& out, const mat<nrows, ncols>& m) {
+template <int nrows, int ncols, Numeric T>
+std::ostream& operator<<(std::ostream& out, const mat<nrows, ncols, T>& m) {
     for(int i = 0; i < nrows; i++)
         out << m[i] << std::endl;
     return out;
 }
 
-template <int n>
+template <int n, Numeric T>
 struct dt { // template metaprogramming to compute the determinant recursively
-    static double det(const mat<n, n>& src) {
-        double ret = 0;
+    static T det(const mat<n, n, T>& src) {
+        T ret = 0;
         for(int i = n; i--; ret += src[0][i] * src.cofactor(0, i))
             ;
         return ret;
     }
 };
 
-template <>
-struct dt<1> { // template specialization to stop the recursion
-    static double det(const mat<1, 1>& src) {
+template <Numeric T>
+struct dt<1, T> { // template specialization to stop the recursion
+    static T det(const mat<1, 1, T>& src) {
         return src[0][0];
     }
 };
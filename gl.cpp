@@ -1,29 +1,39 @@
 #include <algorithm>
 #include <cmath>
+#include <optional>
 
+#if !defined(GL_FORCE_SCALAR) && (defined(__x86_64__) || defined(__i386__))
+#define GL_HAS_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#include "depthbuffer.h"
 #include "geometry.h"
 #include "gl.h"
+#include "imageview.h"
+#include "raster.h"
 #include "tgaimage.h"
 
 namespace gl {
 
-Matrix ViewPort;
-Matrix ModelView;
-Matrix Perspective;
+Matrix   ViewPort;
+Matrix   ModelView;
+Matrix   Perspective;
+CullMode Culling = CullMode::back;
 
-auto lookat(const Vec3d eye, const Vec3d center, const Vec3d up) -> mat<4, 4> {
+auto lookat(const Vec3d eye, const Vec3d center, const Vec3d up) -> Matrix {
     const auto n = normalized(center - eye);
     const auto l = normalized(cross(up, n));
     const auto m = normalized(cross(n, l));
-    return mat<4, 4>{{{l.x, l.y, l.z, 0}, {m.x, m.y, m.z, 0}, {n.x, n.y, n.z, 0}, {0, 0, 0, 1}}} * mat<4, 4>{{{1, 0, 0, -eye.x}, {0, 1, 0, -eye.y}, {0, 0, 1, -eye.z}, {0, 0, 0, 1}}};
+    return mat_cast<Real>(mat<4, 4>{{{l.x, l.y, l.z, 0}, {m.x, m.y, m.z, 0}, {n.x, n.y, n.z, 0}, {0, 0, 0, 1}}} * mat<4, 4>{{{1, 0, 0, -eye.x}, {0, 1, 0, -eye.y}, {0, 0, 1, -eye.z}, {0, 0, 0, 1}}});
 }
 
-auto perspective(const double f) -> mat<4, 4> {
-    return {{{1, 0, 0, 0}, {0, -1, 0, 0}, {0, 0, 1, 0}, {0, 0, -1 / f, 0}}};
+auto perspective(const double f) -> Matrix {
+    return mat_cast<Real>(mat<4, 4>{{{1, 0, 0, 0}, {0, -1, 0, 0}, {0, 0, 1, 0}, {0, 0, -1 / f, 0}}});
 }
 
-auto viewport(const int x, const int y, const int w, const int h) -> mat<4, 4> {
-    return {{{w / 2.0, 0, 0, x + w / 2.0}, {0, h / 2.0, 0, y + h / 2.0}, {0, 0, 1, 0}, {0, 0, 0, 1}}};
+auto viewport(const int x, const int y, const int w, const int h) -> Matrix {
+    return mat_cast<Real>(mat<4, 4>{{{w / 2.0, 0, 0, x + w / 2.0}, {0, h / 2.0, 0, y + h / 2.0}, {0, 0, 1, 0}, {0, 0, 0, 1}}});
 }
 
 auto rotate(const Vec3d v) -> Vec3d {
@@ -39,61 +49,181 @@ auto perspective(const Vec3d v) -> Vec3d {
     return v / (1 - v.z / c);
 }
 
-auto barycentric(const std::array<Vec2d, 3> tri, const Vec2d P) -> Vec3d {
-    const auto ABC = mat<3, 3>{{{tri[0].x, tri[0].y, 1.0}, {tri[1].x, tri[1].y, 1.0}, {tri[2].x, tri[2].y, 1.0}}};
-    if(ABC.det() < 1) return {-1, 1, 1};
-    return ABC.invert_transpose() * Vec3d(P.x, P.y, 1.0);
+auto update_blocks(DepthBuffer& depth, const std::vector<Fragment>& frags) -> void {
+    thread_local auto blocks = std::vector<Vec2i>();
+    blocks.clear();
+    for(const auto& f : frags) {
+        const auto b = Vec2i(f.x / DepthBuffer::block_size, f.y / DepthBuffer::block_size);
+        if(blocks.empty() || blocks.back().x != b.x || blocks.back().y != b.y) blocks.push_back(b);
+    }
+    std::ranges::sort(blocks, [](const Vec2i l, const Vec2i r) { return l.y != r.y ? l.y < r.y : l.x < r.x; });
+    const auto last = std::ranges::unique(blocks, [](const Vec2i l, const Vec2i r) { return l.x == r.x && l.y == r.y; });
+    blocks.erase(last.begin(), last.end());
+    for(const auto b : blocks) {
+        depth.update_block(b.x, b.y);
+    }
 }
 
-auto triangle(const std::array<vec4<double>, 3> t, std::vector<double>& zbuffer, TGAImage& image, const TGAColor& color) -> void {
-    const auto pts  = std::array<Vec4d, 3>{gl::ViewPort * t[0], gl::ViewPort * t[1], gl::ViewPort * t[2]};
-    const auto pts2 = std::array<Vec2d, 3>{(pts[0] / pts[0].w).xy(), (pts[1] / pts[1].w).xy(), (pts[2] / pts[2].w).xy()};
+namespace {
+// Every kernel sums row r of m times (x, y, z, 1) as 0 + m[r][3] + m[r][2] * z + m[r][1] * y + m[r][0] * x,
+// in the order mat * vec does, so they all round alike.
+auto transform_vertex(const Matrix& m, const PositionArrays& p, ScreenVertices& s, const size_t i) -> void {
+    const auto out = std::array{s.x.data(), s.y.data(), s.z.data(), s.w.data()};
+    for(auto r = 0; r < 4; r++) {
+        out[r][i] = Real(0) + m[r][3] + m[r][2] * Real(p.z[i]) + m[r][1] * Real(p.y[i]) + m[r][0] * Real(p.x[i]);
+    }
+}
 
-    const auto [minx, maxx] = std::minmax({pts2[0].x, pts2[1].x, pts2[2].x});
-    const auto [miny, maxy] = std::minmax({pts2[0].y, pts2[1].y, pts2[2].y});
-    const auto bbmin        = Vec2i(std::clamp<int>(minx, 0, image.get_width() - 1), std::clamp<int>(miny, 0, image.get_height() - 1));
-    const auto bbmax        = Vec2i(std::clamp<int>(maxx, 0, image.get_width() - 1), std::clamp<int>(maxy, 0, image.get_height() - 1));
+auto transform_scalar(const Matrix& m, const PositionArrays& p, ScreenVertices& s, const size_t n) -> void {
+    const auto out = std::array{s.x.data(), s.y.data(), s.z.data(), s.w.data()};
+    for(auto r = 0; r < 4; r++) {
+        const auto c = Real(0) + m[r][3];
+        for(auto i = 0uz; i < n; i++) {
+            out[r][i] = c + m[r][2] * Real(p.z[i]) + m[r][1] * Real(p.y[i]) + m[r][0] * Real(p.x[i]);
+        }
+    }
+}
 
-#pragma omp parallel for
-    for(auto x = bbmin.x; x <= bbmax.x; x++) {
-        for(auto y = bbmin.y; y <= bbmax.y; y++) {
-            const auto bc_screen  = barycentric(pts2, {static_cast<double>(x), static_cast<double>(y)});
-            auto       bc_clip    = Vec3d(bc_screen.x / pts[0].w, bc_screen.y / pts[1].w, bc_screen.z / pts[2].w);
-            bc_clip               = bc_clip / (bc_clip.x + bc_clip.y + bc_clip.z);
-            const auto frag_depth = bc_clip * Vec3d(t[0].z, t[1].z, t[2].z);
-            if(bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0 || frag_depth > zbuffer[x + y * image.get_width()]) continue;
-            zbuffer[x + y * image.get_width()] = frag_depth;
-            image.set(x, y, color);
+#ifdef GL_HAS_X86_KERNELS
+#ifdef GL_USE_FLOAT
+__attribute__((target("avx2"))) auto load8(const double* p) -> __m256 {
+    return _mm256_set_m128(_mm256_cvtpd_ps(_mm256_loadu_pd(p + 4)), _mm256_cvtpd_ps(_mm256_loadu_pd(p)));
+}
+
+// 8 vertices at a time; n is a multiple of 8
+__attribute__((target("avx2"))) auto transform_avx2(const Matrix& m, const PositionArrays& p, ScreenVertices& s, const size_t n) -> void {
+    const auto out = std::array{s.x.data(), s.y.data(), s.z.data(), s.w.data()};
+    for(auto i = 0uz; i < n; i += 8) {
+        const auto x = load8(&p.x[i]);
+        const auto y = load8(&p.y[i]);
+        const auto z = load8(&p.z[i]);
+        for(auto r = 0; r < 4; r++) {
+            auto v = _mm256_set1_ps(Real(0) + m[r][3]);
+            v      = _mm256_add_ps(v, _mm256_mul_ps(_mm256_set1_ps(m[r][2]), z));
+            v      = _mm256_add_ps(v, _mm256_mul_ps(_mm256_set1_ps(m[r][1]), y));
+            v      = _mm256_add_ps(v, _mm256_mul_ps(_mm256_set1_ps(m[r][0]), x));
+            _mm256_storeu_ps(out[r] + i, v);
+        }
+    }
+}
+#else
+// 4 vertices at a time; n is a multiple of 4
+__attribute__((target("avx2"))) auto transform_avx2(const Matrix& m, const PositionArrays& p, ScreenVertices& s, const size_t n) -> void {
+    const auto out = std::array{s.x.data(), s.y.data(), s.z.data(), s.w.data()};
+    for(auto i = 0uz; i < n; i += 4) {
+        const auto x = _mm256_load_pd(&p.x[i]);
+        const auto y = _mm256_load_pd(&p.y[i]);
+        const auto z = _mm256_load_pd(&p.z[i]);
+        for(auto r = 0; r < 4; r++) {
+            auto v = _mm256_set1_pd(Real(0) + m[r][3]);
+            v      = _mm256_add_pd(v, _mm256_mul_pd(_mm256_set1_pd(m[r][2]), z));
+            v      = _mm256_add_pd(v, _mm256_mul_pd(_mm256_set1_pd(m[r][1]), y));
+            v      = _mm256_add_pd(v, _mm256_mul_pd(_mm256_set1_pd(m[r][0]), x));
+            _mm256_storeu_pd(out[r] + i, v);
         }
     }
 }
+#endif
+#endif
 
-auto triangle(const std::array<vec4<double>, 3> t, IShader& shader, std::vector<double>& zbuffer, TGAImage& image) -> void {
-    const auto pts  = std::array<Vec4d, 3>{gl::ViewPort * t[0], gl::ViewPort * t[1], gl::ViewPort * t[2]};
-    const auto pts2 = std::array<Vec2d, 3>{(pts[0] / pts[0].w).xy(), (pts[1] / pts[1].w).xy(), (pts[2] / pts[2].w).xy()};
+// The view frustum as linear functions of homogeneous object coordinates, positive inside: a point in front of the eye
+// has W < 0 and is on screen if xmin <= X / W <= xmax and ymin <= Y / W <= ymax. A pixel of margin keeps it conservative.
+auto frustum(const Matrix& m, const int width, const int height) -> std::array<Vec4d, 5> {
+    const auto xmin = Real(-1), xmax = Real(width + 1), ymin = Real(-1), ymax = Real(height + 1);
+    const auto planes = std::array{m[3] * xmin - m[0], m[0] - m[3] * xmax, m[3] * ymin - m[1], m[1] - m[3] * ymax, m[3] * Real(-1)};
+    auto       out    = std::array<Vec4d, 5>();
+    std::ranges::transform(planes, out.begin(), [](const vec4<Real> q) { return vec_cast<double>(q); });
+    return out;
+}
+} // namespace
 
-    const auto [minx, maxx] = std::minmax({pts2[0].x, pts2[1].x, pts2[2].x});
-    const auto [miny, maxy] = std::minmax({pts2[0].y, pts2[1].y, pts2[2].y});
-    const auto bbmin        = Vec2i(std::clamp<int>(minx, 0, image.get_width() - 1), std::clamp<int>(miny, 0, image.get_height() - 1));
-    const auto bbmax        = Vec2i(std::clamp<int>(maxx, 0, image.get_width() - 1), std::clamp<int>(maxy, 0, image.get_height() - 1));
+auto transform_vertices(const Model& model, ScreenVertices& screen) -> void {
+    const auto  m = ViewPort * Perspective * ModelView;
+    const auto& p = model.positions();
+    const auto  n = p.x.size(); // a multiple of position_padding
+    screen.x.resize(n);
+    screen.y.resize(n);
+    screen.z.resize(n);
+    screen.w.resize(n);
+#ifdef GL_HAS_X86_KERNELS
+    if(rasterizer_isa() == Isa::avx2) {
+        transform_avx2(m, p, screen, n);
+        return;
+    }
+#endif
+    transform_scalar(m, p, screen, n);
+}
 
-#pragma omp parallel for
-    for(auto x = bbmin.x; x <= bbmax.x; x++) {
-        for(auto y = bbmin.y; y <= bbmax.y; y++) {
-            const auto bc_screen  = barycentric(pts2, {static_cast<double>(x), static_cast<double>(y)});
-            auto       bc_clip    = Vec3d(bc_screen.x / pts[0].w, bc_screen.y / pts[1].w, bc_screen.z / pts[2].w);
-            bc_clip               = bc_clip / (bc_clip.x + bc_clip.y + bc_clip.z);
-            const auto frag_depth = bc_clip * Vec3d(t[0].z, t[1].z, t[2].z);
-            if(bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0 || frag_depth > zbuffer[x + y * image.get_width()]) continue;
-            auto color = TGAColor();
-            if(shader.fragment(bc_clip, color)) continue;
-            zbuffer[x + y * image.get_width()] = frag_depth;
-            image.set(x, y, color);
+auto transform_meshlets(const Model& model, const int width, const int height, ScreenVertices& screen, std::vector<int>& faces) -> void {
+    const auto  m = ViewPort * Perspective * ModelView;
+    const auto& p = model.positions();
+    screen.x.resize(p.x.size());
+    screen.y.resize(p.x.size());
+    screen.z.resize(p.x.size());
+    screen.w.resize(p.x.size());
+    const auto e      = ModelView.invert() * vec4<Real>(0, 0, 0, 1);
+    const auto eye    = Vec3d(e.x / e.w, e.y / e.w, e.z / e.w);
+    const auto planes = frustum(m, width, height);
+    const auto outside = [&](const Meshlet& c) {
+        for(const auto& q : planes) {
+            const auto distance = q.x * c.center.x + q.y * c.center.y + q.z * c.center.z + q.w;
+            if(distance < -c.radius * std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z)) return true;
+        }
+        return false;
+    };
+    const auto vertices = model.meshlet_vertices();
+    const auto clusters = model.meshlet_faces();
+    for(const auto& c : model.meshlets()) {
+        if(Culling != CullMode::none && facing_away(c, eye, Culling == CullMode::front)) continue;
+        if(outside(c)) continue;
+        for(auto i = c.first_vertex; i < c.first_vertex + c.nvertices; i++) {
+            transform_vertex(m, p, screen, vertices[i]);
         }
+        faces.insert(faces.end(), clusters.begin() + c.first_face, clusters.begin() + c.first_face + c.nfaces);
+    }
+}
+
+auto pick_ray(const double x, const double y) -> Ray {
+    // Points of object space that land on (x, y) satisfy X = x W and Y = y W; W = 0 at the eye, W < 0 in front of it.
+    const auto m = mat_cast<double>(ViewPort * Perspective * ModelView);
+    auto       a = mat<3, 3>();
+    for(auto k = 0; k < 3; k++) {
+        a[0][k] = m[0][k] - x * m[3][k];
+        a[1][k] = m[1][k] - y * m[3][k];
+        a[2][k] = m[3][k];
     }
+    const auto inverse = a.invert();
+    const auto at      = [&](const double w) { return inverse * Vec3d(x * m[3][3] - m[0][3], y * m[3][3] - m[1][3], w - m[3][3]); };
+    const auto origin  = at(0);
+    return {origin, at(-1) - origin};
 }
 
-auto triangle(const std::array<vec3<int>, 3> t, TGAImage& zbuffer, TGAImage& framebuffer, const TGAColor& color) -> void {
+auto triangle(const std::array<vec4<Real>, 3> t, DepthBuffer& zbuffer, TGAImage& image, const TGAColor& color) -> void {
+    triangle(t, zbuffer, image, color, Tile{{0, 0}, {int(image.get_width()) - 1, int(image.get_height()) - 1}});
+}
+
+auto triangle(const std::array<vec4<Real>, 3> t, DepthBuffer& zbuffer, TGAImage& image, const TGAColor& color, const Tile& tile) -> void {
+    thread_local auto setups = std::vector<TriangleSetup>();
+    setups.clear();
+    setup_triangle({gl::ViewPort * t[0], gl::ViewPort * t[1], gl::ViewPort * t[2]}, setups);
+    for(const auto& s : setups) {
+        triangle(s, zbuffer, image, color, tile);
+    }
+}
+
+auto triangle(const TriangleSetup& s, DepthBuffer& zbuffer, TGAImage& image, const TGAColor& color, const Tile& tile) -> void {
+    thread_local auto frags = std::vector<Fragment>();
+    frags.clear();
+    rasterize(s, tile, zbuffer, true, frags);
+    visit_pixels(image, [&, packed = PackedColor(color)](const auto pixels) {
+        for(const auto& f : frags) {
+            pixels.set(f.x, f.y, packed);
+        }
+    });
+    update_blocks(zbuffer, frags);
+}
+
+auto triangle(const std::array<vec3<int>, 3> t, DepthBuffer& zbuffer, TGAImage& framebuffer, const TGAColor& color) -> void {
     const auto [minx, maxx] = std::minmax({t[0].x, t[1].x, t[2].x});
     const auto [miny, maxy] = std::minmax({t[0].y, t[1].y, t[2].y});
     const auto bbmin        = Vec2i(std::clamp<int>(minx, 0, framebuffer.get_width() - 1), std::clamp<int>(miny, 0, framebuffer.get_height() - 1));
@@ -104,20 +234,29 @@ auto triangle(const std::array<vec3<int>, 3> t, TGAImage& zbuffer, TGAImage& fra
     const auto t2vec2     = vec2<int>{t[2].x, t[2].y};
     const auto total_area = signed_triangle_area(t0vec2, t1vec2, t2vec2);
     if(total_area < 1) return; // back-face culling
-#pragma omp parallel for
-    for(auto x = bbmin.x; x <= bbmax.x; x++) {
-        for(auto y = bbmin.y; y <= bbmax.y; y++) {
-            const auto pos   = vec2<int>(x, y);
-            const auto alpha = signed_triangle_area(pos, t1vec2, t2vec2) / total_area;
-            const auto beta  = signed_triangle_area(pos, t2vec2, t0vec2) / total_area;
-            const auto gamma = signed_triangle_area(pos, t0vec2, t1vec2) / total_area;
-            if(alpha < 0 || beta < 0 || gamma < 0) continue; // outside of the triangle
-            const auto z = static_cast<uint8_t>(alpha * t[0].z + beta * t[1].z + gamma * t[2].z);
-            if(z < zbuffer.get(x, y).raw[0]) continue;
-            zbuffer.set(x, y, TGAColor(z, 1));
-            framebuffer.set(x, y, color);
+    constexpr auto n = DepthBuffer::tile_size;
+    for(auto ty = bbmin.y / n; ty <= bbmax.y / n; ty++) {
+        for(auto tx = bbmin.x / n; tx <= bbmax.x / n; tx++) {
+            zbuffer.tile(tx, ty); // clear before the parallel loop
         }
     }
+    visit_pixels(framebuffer, [&, packed = PackedColor(color)](const auto pixels) {
+#pragma omp parallel for
+        for(auto x = bbmin.x; x <= bbmax.x; x++) {
+            for(auto y = bbmin.y; y <= bbmax.y; y++) {
+                const auto pos   = vec2<int>(x, y);
+                const auto alpha = signed_triangle_area(pos, t1vec2, t2vec2) / total_area;
+                const auto beta  = signed_triangle_area(pos, t2vec2, t0vec2) / total_area;
+                const auto gamma = signed_triangle_area(pos, t0vec2, t1vec2) / total_area;
+                if(alpha < 0 || beta < 0 || gamma < 0) continue; // outside of the triangle
+                const auto z   = static_cast<uint8_t>(alpha * t[0].z + beta * t[1].z + gamma * t[2].z);
+                const auto key = zbuffer.encode(Real(255 - z) / 256);
+                if(key > zbuffer.key(x, y)) continue;
+                zbuffer.key(x, y) = key; // only ever nearer, so the farthest depth of the block stays an upper bound
+                pixels.set(x, y, packed);
+            }
+        }
+    });
 }
 
 // 2D
@@ -127,16 +266,18 @@ auto triangle(const std::array<vec2<int>, 3> t, TGAImage& framebuffer, const TGA
     const auto bbmin        = Vec2i(std::clamp<int>(minx, 0, framebuffer.get_width() - 1), std::clamp<int>(miny, 0, framebuffer.get_height() - 1));
     const auto bbmax        = Vec2i(std::clamp<int>(maxx, 0, framebuffer.get_width() - 1), std::clamp<int>(maxy, 0, framebuffer.get_height() - 1));
     const auto total_area   = signed_triangle_area(t[0], t[1], t[2]);
+    visit_pixels(framebuffer, [&, packed = PackedColor(color)](const auto pixels) {
 #pragma omp parallel for
-    for(auto x = bbmin.x; x <= bbmax.x; x++) {
-        for(auto y = bbmin.y; y <= bbmax.y; y++) {
-            const auto pos   = vec2<int>(x, y);
-            const auto alpha = signed_triangle_area(pos, t[1], t[2]) / total_area;
-            const auto beta  = signed_triangle_area(pos, t[2], t[0]) / total_area;
-            const auto gamma = signed_triangle_area(pos, t[0], t[1]) / total_area;
-            if(alpha < 0 || beta < 0 || gamma < 0) continue; // outside of the triangle
-            framebuffer.set(x, y, color);
+        for(auto x = bbmin.x; x <= bbmax.x; x++) {
+            for(auto y = bbmin.y; y <= bbmax.y; y++) {
+                const auto pos   = vec2<int>(x, y);
+                const auto alpha = signed_triangle_area(pos, t[1], t[2]) / total_area;
+                const auto beta  = signed_triangle_area(pos, t[2], t[0]) / total_area;
+                const auto gamma = signed_triangle_area(pos, t[0], t[1]) / total_area;
+                if(alpha < 0 || beta < 0 || gamma < 0) continue; // outside of the triangle
+                pixels.set(x, y, packed);
+            }
         }
-    }
+    });
 }
 } // namespace gl
@@ -1,57 +1,137 @@
 #pragma once
 
+#include <array>
+#include <concepts>
+#include <utility>
 #include <vector>
 
 #include "geometry.h"
 #include "model.h"
+#include "texture.h"
 #include "tgaimage.h"
 
 namespace gl {
-using Matrix = mat<4, 4>;
+// scalar type of the shaded pipeline: clip coordinates, interpolation and depth
+#ifdef GL_USE_FLOAT
+using Real = float;
+#else
+using Real = double;
+#endif
+using Matrix = mat<4, 4, Real>;
 
-extern Matrix ModelView;
-extern Matrix ViewPort;
-extern Matrix Perspective;
+enum class CullMode {
+    none,
+    back,  // front faces are counter-clockwise as seen from the eye, the OBJ convention
+    front,
+};
+
+extern Matrix   ModelView;
+extern Matrix   ViewPort;
+extern Matrix   Perspective;
+extern CullMode Culling; // faces dropped by the perspective pipeline, CullMode::back by default
+
+// A shader is stateless during rasterization: everything it interpolates over a triangle lives in its Varying,
+// filled by vertex() or varying() per corner and only read by fragment(), so one instance is shared by all threads.
+// fragment() writes the color of the pixel; the image keeps as many of its channels as its format has.
+template <typename T>
+concept ShaderConcept = requires(const T& shader, typename T::Varying& out, const vec3<Real> bar, PackedColor& color) {
+    { shader.vertex(0, 0, out) } -> std::same_as<vec4<Real>>;
+    { shader.varying(0, 0, out) } -> std::same_as<void>; // vertex() without the position, for cached vertices
+    { shader.fragment(std::as_const(out), bar, color) } -> std::same_as<bool>;
+};
 
-struct IShader {
-    virtual Vec4d vertex(const int iface, const int nthvert) = 0;
-    virtual bool  fragment(const Vec3d bar, TGAColor& color) = 0;
+// A shader whose fragment() also takes the derivatives of the barycentric coordinates from one pixel to the next along
+// x and along y, e.g. to filter textures. The rasterizer gives it those of the 2x2 quad of pixels the fragment is in.
+template <typename T>
+concept DerivativeShader = ShaderConcept<T> && requires(const T& shader, const typename T::Varying& in, const vec3<Real> bar, PackedColor& color) {
+    { shader.fragment(in, bar, bar, bar, color) } -> std::same_as<bool>;
 };
 
-struct Shader : IShader {
+struct Shader {
+    struct Varying {
+        mat<3, 2, Real> uv;
+    };
+
     const Model& model;
-    mat<3, 2>    varying_uv;
 
     Shader(const Model& m) : model(m) {}
 
-    virtual Vec4d vertex(const int iface, const int nthvert) {
-        const auto vert     = model.vert(iface, nthvert);
-        varying_uv[nthvert] = model.uv(iface, nthvert);
-        const auto gl_pos   = gl::ModelView * Vec4d(vert.x, vert.y, vert.z, 1.0);
+    auto vertex(const int iface, const int nthvert, Varying& out) const -> vec4<Real> {
+        varying(iface, nthvert, out);
+        const auto vert   = model.vert(iface, nthvert);
+        const auto gl_pos = gl::ModelView * vec4<Real>(vert.x, vert.y, vert.z, 1.0);
         return gl::Perspective * gl_pos;
     }
 
-    virtual bool fragment(Vec3d bar, TGAColor& color) {
-        const auto  tex_interpolation = bar * varying_uv;
-        const auto& diffuse           = model.diffuse();
-        const auto  uv                = Vec2d(tex_interpolation.x * diffuse.get_width(), tex_interpolation.y * diffuse.get_height());
-        color                         = diffuse.get(uv.x, uv.y);
+    auto varying(const int iface, const int nthvert, Varying& out) const -> void {
+        out.uv[nthvert] = vec_cast<Real>(model.uv(iface, nthvert));
+    }
+
+    auto fragment(const Varying& in, const vec3<Real> bar, PackedColor& color) const -> bool {
+        const auto  uv      = bar * in.uv;
+        const auto& diffuse = model.diffuse();
+        color               = PackedColor(diffuse.sample(uv.x, uv.y));
         return false;
     }
 };
 
-template <typename T>
-concept ShaderConcept = std::is_base_of_v<gl::IShader, T>;
+// Shader for a diffuse map loaded with mipmaps: samples it trilinearly, at the level of detail of the quad's texture
+// coordinate derivatives, instead of taking the nearest texel of the full size map.
+struct MipShader : Shader {
+    using Shader::fragment;
+    using Shader::Shader;
 
-auto lookat(const Vec3d eye, const Vec3d center, const Vec3d up) -> mat<4, 4>;
-auto perspective(const double f) -> mat<4, 4>;
-auto viewport(const int x, const int y, const int w, const int h) -> mat<4, 4>;
+    auto fragment(const Varying& in, const vec3<Real> bar, const vec3<Real> dbar_dx, const vec3<Real> dbar_dy, PackedColor& color) const -> bool {
+        const auto  uv      = bar * in.uv;
+        const auto  duv_dx  = dbar_dx * in.uv;
+        const auto  duv_dy  = dbar_dy * in.uv;
+        const auto& diffuse = model.diffuse();
+        const auto  lod     = diffuse.lod(duv_dx.x, duv_dx.y, duv_dy.x, duv_dy.y);
+        color               = PackedColor(diffuse.sample(uv.x, uv.y, lod));
+        return false;
+    }
+};
+
+class DepthBuffer;
+
+// screen-space rectangle, both corners inclusive
+struct Tile {
+    Vec2i bbmin;
+    Vec2i bbmax;
+};
+
+auto lookat(const Vec3d eye, const Vec3d center, const Vec3d up) -> Matrix;
+auto perspective(const double f) -> Matrix;
+auto viewport(const int x, const int y, const int w, const int h) -> Matrix;
 
 auto rotate(const Vec3d v) -> Vec3d;
 auto perspective(const Vec3d v) -> Vec3d;
-auto triangle(const std::array<vec4<double>, 3> t, std::vector<double>& zbuffer, TGAImage& image, const TGAColor& color) -> void;
-auto triangle(const std::array<vec4<double>, 3> t, IShader& shader, std::vector<double>& zbuffer, TGAImage& image) -> void;
-auto triangle(const std::array<vec3<int>, 3> t, TGAImage& zbuffer, TGAImage& framebuffer, const TGAColor& color) -> void;
+// Vertices in screen coordinates, one array per coordinate like Model::positions(), padded the same way.
+struct ScreenVertices {
+    std::vector<Real> x = {};
+    std::vector<Real> y = {};
+    std::vector<Real> z = {};
+    std::vector<Real> w = {};
+
+    auto operator[](const size_t i) const -> vec4<Real> { return {x[i], y[i], z[i], w[i]}; }
+};
+
+// Transforms every vertex of the model once by ViewPort * Perspective * ModelView into screen coordinates,
+// i.e. homogeneous coordinates after the viewport transform but before the perspective division.
+// screen[i] corresponds to model.vert(i), faces look their corners up through Model::vert_index.
+// Works on several vertices at a time with the widest vector unit the CPU has, with the same results as one at a time.
+auto transform_vertices(const Model& model, ScreenVertices& screen) -> void;
+// Culls the meshlets of the model that are outside the width x height screen or, as Culling says, entirely back-facing
+// or front-facing. Transforms the vertices of the others like transform_vertices, leaving the rest of screen unspecified,
+// and appends their faces to faces.
+auto transform_meshlets(const Model& model, const int width, const int height, ScreenVertices& screen, std::vector<int>& faces) -> void;
+// Ray in object coordinates from the eye through the screen point (x, y), both for the current matrices.
+auto pick_ray(const double x, const double y) -> Ray;
+auto triangle(const std::array<vec4<Real>, 3> t, DepthBuffer& zbuffer, TGAImage& image, const TGAColor& color) -> void;
+auto triangle(const std::array<vec4<Real>, 3> t, DepthBuffer& zbuffer, TGAImage& image, const TGAColor& color, const Tile& tile) -> void;
+// the shaded overloads are templates on ShaderConcept, see raster.h
+// z in [0, 255], larger is nearer; stored as depth (255 - z) / 256
+auto triangle(const std::array<vec3<int>, 3> t, DepthBuffer& zbuffer, TGAImage& framebuffer, const TGAColor& color) -> void;
 auto triangle(const std::array<vec2<int>, 3> t, TGAImage& framebuffer, const TGAColor& color) -> void;
 
 template <Numeric T>
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <type_traits>
+
+#include "tgaimage.h"
+
+// Unchecked access to the pixels of a TGAImage whose format F is known at compile time. A pixel is F bytes, so reading
+// or writing one is a fixed-size load or store rather than a memcpy of get_format() bytes, and there is no bounds check:
+// coordinates must be in range. Byte is const uint8_t for a view that only reads.
+// A view does not own the pixels and is valid until the image is resized or assigned to.
+template <TGAImage::Format F, typename Byte = uint8_t>
+    requires std::is_same_v<std::remove_const_t<Byte>, uint8_t>
+class ImageView {
+    Byte*  pixels;
+    size_t width;
+    size_t height;
+
+  public:
+    using Image = std::conditional_t<std::is_const_v<Byte>, const TGAImage, TGAImage>;
+
+    static constexpr auto bpp = size_t(F);
+
+    // the image must have format F
+    explicit ImageView(Image& image) : pixels(image.buffer()), width(image.get_width()), height(image.get_height()) {}
+
+    auto get_width() const -> size_t { return width; }
+    auto get_height() const -> size_t { return height; }
+    // the width * bpp bytes of row y
+    auto row(const size_t y) const -> std::span<Byte> { return {pixels + y * width * bpp, width * bpp}; }
+    auto pixel(const size_t x, const size_t y) const -> Byte* { return pixels + (x + y * width) * bpp; }
+    // channels the format does not have are zero
+    auto get(const size_t x, const size_t y) const -> PackedColor {
+        auto c = PackedColor();
+        std::memcpy(static_cast<void*>(&c), pixel(x, y), bpp); // PackedColor is trivially copyable
+        return c;
+    }
+    auto set(const size_t x, const size_t y, const PackedColor c) const -> void
+        requires(!std::is_const_v<Byte>)
+    {
+        std::memcpy(pixel(x, y), &c, bpp);
+    }
+};
+
+// Calls f with the ImageView of the image for its format, read-only for a const image, and returns what f returns.
+// The format is switched on once per call instead of once per pixel; f is compiled for every format.
+template <typename Image, typename Function>
+    requires std::is_same_v<std::remove_const_t<Image>, TGAImage>
+auto visit_pixels(Image& image, Function&& f) -> decltype(auto) {
+    using Byte = std::conditional_t<std::is_const_v<Image>, const uint8_t, uint8_t>;
+    switch(image.get_format()) {
+    case TGAImage::GRAYSCALE: return f(ImageView<TGAImage::GRAYSCALE, Byte>(image));
+    case TGAImage::RGB: return f(ImageView<TGAImage::RGB, Byte>(image));
+    default: return f(ImageView<TGAImage::RGBA, Byte>(image));
+    }
+}
@@ -0,0 +1,58 @@
+#include <algorithm>
+#include <mutex>
+#include <utility>
+
+#include "imagewriter.h"
+
+ImageWriter::ImageWriter(const size_t max_pending, const unsigned nthreads, const unsigned encode_threads)
+    : max_pending(std::max(max_pending, 1uz)), encode_threads(encode_threads) {
+    for(auto i = 0u; i < std::max(nthreads, 1u); i++) {
+        threads.emplace_back([this] { drain(); });
+    }
+}
+
+ImageWriter::~ImageWriter() {
+    {
+        const auto lock = std::lock_guard(mutex);
+        stopping        = true;
+    }
+    ready.notify_all();
+    threads.clear(); // joins once the queue is empty
+}
+
+auto ImageWriter::drain() -> void {
+    while(true) {
+        auto job = Job();
+        {
+            auto lock = std::unique_lock(mutex);
+            ready.wait(lock, [&] { return !queue.empty() || stopping; });
+            if(queue.empty()) return;
+            job = std::move(queue.front());
+            queue.pop_front();
+            busy++;
+        }
+        space.notify_one();
+        const auto ok = job.image.write_tga_file(job.filename, job.rle, encode_threads);
+        {
+            const auto lock = std::lock_guard(mutex);
+            busy--;
+            failed |= !ok;
+        }
+        idle.notify_all();
+    }
+}
+
+auto ImageWriter::write(TGAImage&& image, std::string filename, const bool rle) -> void {
+    {
+        auto lock = std::unique_lock(mutex);
+        space.wait(lock, [&] { return queue.size() < max_pending; });
+        queue.push_back({std::move(image), std::move(filename), rle});
+    }
+    ready.notify_one();
+}
+
+auto ImageWriter::flush() -> bool {
+    auto lock = std::unique_lock(mutex);
+    idle.wait(lock, [&] { return queue.empty() && busy == 0; });
+    return !std::exchange(failed, false);
+}
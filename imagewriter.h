@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tgaimage.h"
+
+// Writes images to TGA files on background threads, so that rendering the next frame overlaps encoding and writing
+// the previous ones. Images are moved in, never copied. write() blocks while max_pending images wait for a thread,
+// which bounds the memory of the queue to max_pending + nthreads images.
+class ImageWriter {
+    struct Job {
+        TGAImage    image    = {};
+        std::string filename = {};
+        bool        rle      = true;
+    };
+
+    std::mutex                mutex          = {};
+    std::condition_variable   ready          = {}; // a job was queued, or the writer is stopping
+    std::condition_variable   space          = {}; // a job left the queue
+    std::condition_variable   idle           = {}; // a job was written
+    std::deque<Job>           queue          = {};
+    size_t                    max_pending    = 0;
+    unsigned                  encode_threads = 1;
+    size_t                    busy           = 0; // jobs being written
+    bool                      failed         = false;
+    bool                      stopping       = false;
+    std::vector<std::jthread> threads        = {};
+
+    auto drain() -> void;
+
+  public:
+    // Every image is encoded with encode_threads threads, see TGAImage::write_tga_file.
+    explicit ImageWriter(const size_t max_pending = 2, const unsigned nthreads = 1, const unsigned encode_threads = 1);
+    ImageWriter(const ImageWriter&)            = delete;
+    ImageWriter& operator=(const ImageWriter&) = delete;
+    // writes whatever is still queued
+    ~ImageWriter();
+
+    // Queues the image to be written to filename; waits while max_pending images are queued.
+    auto write(TGAImage&& image, std::string filename, const bool rle = true) -> void;
+    // Waits until every queued image is written. False if writing one of them failed since the last flush.
+    auto flush() -> bool;
+};
@@ -1,6 +1,8 @@
-#include <limits>
 #include <print>
+#include <string_view>
+#include <thread>
 
+#include "meshstream.h"
 #include "model.h"
 #include "paint_example.h"
 #include "tgaimage.h"
@@ -15,27 +17,58 @@ auto main(int argc, char** argv) -> int {
 
     // paint_sample_triangle(framebuffer);
     // load model
-    if(argc != 2) {
-        std::println(stderr, "Usage: {} path/to/model.obj", argv[0]);
+    auto streaming = false;
+    auto mipmaps   = false;
+    auto arg       = 1;
+    for(; arg < argc - 1; arg++) {
+        const auto option = std::string_view(argv[arg]);
+        if(option == "--stream") {
+            streaming = true;
+        } else if(option == "--mipmaps") {
+            mipmaps = true;
+        } else {
+            break;
+        }
+    }
+    if(arg != argc - 1) {
+        std::println(stderr, "Usage: {} [--stream] [--mipmaps] path/to/model.obj", argv[0]);
         return 1;
     }
+    const auto path = argv[arg];
+    if(streaming) {
+        // the model is never loaded whole, see MeshStream
+        auto stream = MeshStream(path);
+        if(!stream.is_open() || !stream.load_diffusemap(mipmaps)) {
+            return 1;
+        }
+        auto zbuffer = gl::DepthBuffer(width, height);
+        if(mipmaps) {
+            paint_perspective_stream_with_diffusemap<gl::MipShader>(zbuffer, framebuffer, stream, width, height);
+        } else {
+            paint_perspective_stream_with_diffusemap<gl::Shader>(zbuffer, framebuffer, stream, width, height);
+        }
+        return framebuffer.write_tga_file("output.tga", true, std::thread::hardware_concurrency()) ? 0 : 1;
+    }
 
-    auto model = Model(argv[1]);
-    if(!model.load_diffusemap(argv[1])) {
+    auto model = Model(path);
+    if(!model.load_diffusemap(path, mipmaps)) {
         return 1;
     }
 
     /*
     {
-        auto zbuffer = TGAImage(width, height, TGAImage::GRAYSCALE);
+        auto zbuffer = gl::DepthBuffer(width, height);
         // paint_clown_model(zbuffer, framebuffer, model, width, height);
         // paint_illumination_model(zbuffer, framebuffer, model, width, height);
     }
     */
 
-    auto zbuffer = std::vector<double>(width * height, std::numeric_limits<double>::max());
+    auto zbuffer = gl::DepthBuffer(width, height);
     // paint_perspective_clown_model(zbuffer, framebuffer, model, width, height);
-    paint_perspective_with_diffusemap<gl::Shader>(zbuffer, framebuffer, model, width, height);
-    framebuffer.write_tga_file("output.tga");
-    return 0;
+    if(mipmaps) {
+        paint_perspective_with_diffusemap<gl::MipShader>(zbuffer, framebuffer, model, width, height);
+    } else {
+        paint_perspective_with_diffusemap<gl::Shader>(zbuffer, framebuffer, model, width, height);
+    }
+    return framebuffer.write_tga_file("output.tga", true, std::thread::hardware_concurrency()) ? 0 : 1;
 }
@@ -0,0 +1,49 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "mappedfile.h"
+
+namespace {
+#ifdef MAP_POPULATE
+constexpr auto populate_flag = MAP_POPULATE;
+#else
+constexpr auto populate_flag = 0;
+#endif
+} // namespace
+
+MappedFile::MappedFile(const std::string& path, const bool populate) {
+    const auto fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) return;
+    struct stat st = {};
+    if(::fstat(fd, &st) == 0) {
+        length = size_t(st.st_size);
+        if(length == 0) {
+            ok = true; // mmap refuses empty mappings
+        } else {
+            addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE | (populate ? populate_flag : 0), fd, 0);
+            if(addr == MAP_FAILED) {
+                addr   = nullptr;
+                length = 0;
+            } else {
+                ok = true;
+            }
+        }
+    }
+    ::close(fd);
+}
+
+auto MappedFile::release(const size_t offset, const size_t size) const -> void {
+    // whole pages inside the range only, the ones at its ends may still be in use
+    const auto page  = size_t(::sysconf(_SC_PAGESIZE));
+    const auto first = (offset + page - 1) / page * page;
+    const auto last  = std::min(offset + size, length) / page * page;
+    if(addr && first < last) ::madvise(static_cast<char*>(addr) + first, last - first, MADV_DONTNEED);
+}
+
+MappedFile::~MappedFile() {
+    if(addr) ::munmap(addr, length);
+}
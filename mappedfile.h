@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a whole file, unmapped on destruction.
+// With populate the file is read in at once; otherwise pages are read as they are touched.
+class MappedFile {
+    void*  addr   = nullptr;
+    size_t length = 0;
+    bool   ok     = false;
+
+  public:
+    explicit MappedFile(const std::string& path, const bool populate = true);
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    auto is_open() const -> bool { return ok; }
+    auto data() const -> std::string_view { return {static_cast<const char*>(addr), length}; }
+    // Drops the pages of data().substr(offset, size) from memory, they are read again if touched.
+    // Bounds the memory of a file read once from front to back.
+    auto release(const size_t offset, const size_t size) const -> void;
+};
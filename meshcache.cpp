@@ -0,0 +1,188 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <type_traits>
+
+#include "meshcache.h"
+
+namespace {
+static_assert(sizeof(Vertex) == 8 * sizeof(double) && std::is_trivially_copyable_v<Vertex>);
+static_assert(sizeof(Meshlet) == 12 * sizeof(double) && std::is_trivially_copyable_v<Meshlet>);
+
+constexpr auto magic     = std::array<char, 8>{'t', 'r', 'm', 'e', 's', 'h', '\0', '\0'};
+constexpr auto version   = uint32_t(4); // also catches caches written with the other byte order
+constexpr auto alignment = sizeof(CacheLine);
+
+struct Header {
+    std::array<char, 8> magic;
+    uint32_t            version;
+    TriangleOrder       order;
+    FileStamp           obj;
+    FileStamp           diffuse;
+    uint64_t            nvertices;
+    uint64_t            nindices;
+    uint32_t            diffuse_width;
+    uint32_t            diffuse_height;
+    uint32_t            diffuse_bpp;
+    uint32_t            reserved;
+    uint64_t            nmeshlets;
+    uint64_t            nmeshlet_vertices;
+    uint64_t            nmeshlet_faces;
+};
+
+enum class Section { vertices, indices, x, y, z, meshlets, meshlet_vertices, meshlet_faces, diffuse };
+constexpr auto nsections = 9;
+
+struct Layout {
+    std::array<size_t, nsections> offsets;
+    size_t                        size;
+};
+
+auto align(const size_t n, const size_t to = alignment) -> size_t { return (n + to - 1) / to * to; }
+
+auto layout(const Header& h) -> Layout {
+    const auto sizes = std::array<size_t, nsections>{
+        h.nvertices * sizeof(Vertex),
+        h.nindices * sizeof(int),
+        align(h.nvertices, position_padding) * sizeof(double),
+        align(h.nvertices, position_padding) * sizeof(double),
+        align(h.nvertices, position_padding) * sizeof(double),
+        h.nmeshlets * sizeof(Meshlet),
+        h.nmeshlet_vertices * sizeof(int),
+        h.nmeshlet_faces * sizeof(int),
+        size_t(h.diffuse_width) * h.diffuse_height * h.diffuse_bpp,
+    };
+    auto l = Layout{};
+    l.size = align(sizeof(Header));
+    for(auto i = 0; i < nsections; i++) {
+        l.offsets[i] = l.size;
+        l.size       = align(l.size + sizes[i]);
+    }
+    return l;
+}
+
+// True if every array of the mesh only refers to elements that exist: a cache is trusted once loaded, so a damaged
+// one must not get past read_mesh_cache.
+auto in_range(const MeshView& mesh) -> bool {
+    const auto below = [](const std::span<const int> array, const size_t n) {
+        return std::ranges::all_of(array, [n](const int i) { return i >= 0 && size_t(i) < n; });
+    };
+    const auto nfaces = mesh.indices.size() / 3;
+    if(!below(mesh.indices, mesh.vertices.size())) return false;
+    if(!below(mesh.meshlet_vertices, mesh.vertices.size()) || !below(mesh.meshlet_faces, nfaces)) return false;
+    return std::ranges::all_of(mesh.meshlets, [&](const Meshlet& m) {
+        return size_t(m.first_vertex) + m.nvertices <= mesh.meshlet_vertices.size() && size_t(m.first_face) + m.nfaces <= mesh.meshlet_faces.size();
+    });
+}
+
+template <typename T>
+auto section(const std::string_view image, const Layout& l, const Section s, const size_t n) -> std::span<const T> {
+    return {reinterpret_cast<const T*>(image.data() + l.offsets[size_t(s)]), n};
+}
+} // namespace
+
+auto file_stamp(const std::string& path) -> FileStamp {
+    auto       ec   = std::error_code();
+    const auto size = std::filesystem::file_size(path, ec);
+    if(ec) return {};
+    const auto time = std::filesystem::last_write_time(path, ec);
+    if(ec) return {};
+    return {size, int64_t(time.time_since_epoch().count())};
+}
+
+auto write_mesh_cache(const MeshView& mesh, const FileStamp& obj, const FileStamp& diffuse) -> std::vector<CacheLine> {
+    const auto header = Header{
+        .magic             = magic,
+        .version           = version,
+        .order             = mesh.order,
+        .obj               = obj,
+        .diffuse           = diffuse,
+        .nvertices         = mesh.vertices.size(),
+        .nindices          = mesh.indices.size(),
+        .diffuse_width     = uint32_t(mesh.diffuse.empty() ? 0 : mesh.diffuse_width),
+        .diffuse_height    = uint32_t(mesh.diffuse.empty() ? 0 : mesh.diffuse_height),
+        .diffuse_bpp       = uint32_t(mesh.diffuse.empty() ? 0 : mesh.diffuse_bpp),
+        .reserved          = 0,
+        .nmeshlets         = mesh.meshlets.size(),
+        .nmeshlet_vertices = mesh.meshlet_vertices.size(),
+        .nmeshlet_faces    = mesh.meshlet_faces.size(),
+    };
+    const auto l     = layout(header);
+    auto       image = std::vector<CacheLine>(l.size / sizeof(CacheLine)); // zeroes the padding
+    auto*      bytes = reinterpret_cast<std::byte*>(image.data());
+    std::memcpy(bytes, &header, sizeof(header));
+    const auto put = [&](const Section s, const auto array) {
+        if(!array.empty()) std::memcpy(bytes + l.offsets[size_t(s)], array.data(), array.size_bytes());
+    };
+    put(Section::vertices, mesh.vertices);
+    put(Section::indices, mesh.indices);
+    put(Section::meshlets, mesh.meshlets);
+    put(Section::meshlet_vertices, mesh.meshlet_vertices);
+    put(Section::meshlet_faces, mesh.meshlet_faces);
+    put(Section::diffuse, mesh.diffuse);
+    auto* x = reinterpret_cast<double*>(bytes + l.offsets[size_t(Section::x)]);
+    auto* y = reinterpret_cast<double*>(bytes + l.offsets[size_t(Section::y)]);
+    auto* z = reinterpret_cast<double*>(bytes + l.offsets[size_t(Section::z)]);
+    for(auto i = 0uz; i < mesh.vertices.size(); i++) {
+        x[i] = mesh.vertices[i].pos.x;
+        y[i] = mesh.vertices[i].pos.y;
+        z[i] = mesh.vertices[i].pos.z;
+    }
+    return image;
+}
+
+auto read_mesh_cache(const std::string_view image, const TriangleOrder order, const FileStamp& obj, const FileStamp& diffuse, const bool check_ranges) -> std::optional<MeshView> {
+    auto h = Header{};
+    if(image.size() < sizeof(h)) return std::nullopt;
+    std::memcpy(&h, image.data(), sizeof(h));
+    if(h.magic != magic || h.version != version || h.order != order || h.obj != obj || h.diffuse != diffuse) return std::nullopt;
+    // bounds the counts before they are multiplied, a damaged header must not overflow the layout
+    for(const auto n : {h.nvertices, h.nindices, h.nmeshlets, h.nmeshlet_vertices, h.nmeshlet_faces}) {
+        if(n > image.size()) return std::nullopt;
+    }
+    if(h.diffuse_width > 0xffff || h.diffuse_height > 0xffff || h.diffuse_bpp > 4) return std::nullopt;
+    const auto l = layout(h);
+    if(l.size != image.size()) return std::nullopt;
+    const auto mesh = MeshView{
+        .vertices         = section<Vertex>(image, l, Section::vertices, h.nvertices),
+        .indices          = section<int>(image, l, Section::indices, h.nindices),
+        .positions        = {section<double>(image, l, Section::x, align(h.nvertices, position_padding)),
+                             section<double>(image, l, Section::y, align(h.nvertices, position_padding)),
+                             section<double>(image, l, Section::z, align(h.nvertices, position_padding))},
+        .meshlets         = section<Meshlet>(image, l, Section::meshlets, h.nmeshlets),
+        .meshlet_vertices = section<int>(image, l, Section::meshlet_vertices, h.nmeshlet_vertices),
+        .meshlet_faces    = section<int>(image, l, Section::meshlet_faces, h.nmeshlet_faces),
+        .order            = h.order,
+        .diffuse          = section<uint8_t>(image, l, Section::diffuse, size_t(h.diffuse_width) * h.diffuse_height * h.diffuse_bpp),
+        .diffuse_width    = int(h.diffuse_width),
+        .diffuse_height   = int(h.diffuse_height),
+        .diffuse_bpp      = int(h.diffuse_bpp),
+    };
+    if(check_ranges && !in_range(mesh)) return std::nullopt;
+    return mesh;
+}
+
+auto save_mesh_cache(const std::string& path, const std::span<const std::byte> image) -> bool {
+    const auto tmp = std::format("{}.{}.tmp", path, ::getpid());
+    auto       ec  = std::error_code();
+    {
+        auto out = std::ofstream(tmp, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(image.data()), std::streamsize(image.size()));
+        if(!out.good()) {
+            out.close();
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp, path, ec);
+    if(ec) {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "geometry.h"
+#include "meshlet.h"
+
+// A corner of the faces of an .obj: the (v, vt, vn) triplet it refers to, unique within a mesh.
+struct Vertex {
+    Vec3d pos;
+    Vec2d uv;
+    Vec3d normal;
+};
+
+enum class TriangleOrder : uint32_t {
+    file,    // as the faces appear in the .obj
+    tipsify, // reordered for the post-transform vertex cache, see vertexcache.h
+};
+
+// Vertex positions as separate arrays, for transforming several vertices at a time.
+// Each is 64-byte aligned and padded with zeros to a multiple of position_padding elements.
+struct PositionArrays {
+    std::span<const double> x = {};
+    std::span<const double> y = {};
+    std::span<const double> z = {};
+};
+
+constexpr auto position_padding = 8uz;
+
+// A cache image in memory is made of these, so that it is aligned like a mapped one.
+struct alignas(64) CacheLine {
+    std::byte bytes[64];
+};
+
+// Arrays of a mesh as the Model uses them. They do not own their memory, which is a mesh cache image,
+// either a mapped file or a buffer.
+struct MeshView {
+    std::span<const Vertex>  vertices         = {};
+    std::span<const int>     indices          = {}; // three per face, into vertices
+    PositionArrays           positions        = {}; // of the vertices
+    std::span<const Meshlet> meshlets         = {};
+    std::span<const int>     meshlet_vertices = {};
+    std::span<const int>     meshlet_faces    = {};
+    TriangleOrder            order            = TriangleOrder::file;
+    std::span<const uint8_t> diffuse          = {}; // decoded pixels as in TGAImage::buffer(), empty if none was inlined
+    int                      diffuse_width    = 0;
+    int                      diffuse_height   = 0;
+    int                      diffuse_bpp      = 0;
+};
+
+// Size and modification time of a source file, all zero if it does not exist.
+// A cache is only valid for the sources it was made from.
+struct FileStamp {
+    uint64_t size  = 0;
+    int64_t  mtime = 0;
+
+    auto operator==(const FileStamp&) const -> bool = default;
+};
+
+auto file_stamp(const std::string& path) -> FileStamp;
+
+// Mesh cache format: a header with a magic, a version, the triangle order and the stamps of the .obj and of the diffuse
+// map, then the arrays of MeshView one after the other, each 64-byte aligned, in native byte order.
+// Serializes a mesh; the position arrays are made from the vertices, the pixels of the diffuse map are inlined if
+// mesh.diffuse is not empty.
+auto write_mesh_cache(const MeshView& mesh, const FileStamp& obj, const FileStamp& diffuse) -> std::vector<CacheLine>;
+// Points into a cache image; nullopt if it is malformed, refers to vertices, faces or meshlet ranges that are not
+// there, is from another version, in another order or made from other sources. The image must be 64-byte aligned, as a
+// mapping or a vector of CacheLine is.
+// Without check_ranges only the header is read and the arrays are not scanned, e.g. to look a stream over without
+// paging it in; the view must then not be used before it has been read again with the check.
+auto read_mesh_cache(std::string_view image, const TriangleOrder order, const FileStamp& obj, const FileStamp& diffuse, const bool check_ranges = true) -> std::optional<MeshView>;
+// Writes to a temporary file renamed over path, so that concurrent readers never map a partial cache.
+auto save_mesh_cache(const std::string& path, std::span<const std::byte> image) -> bool;
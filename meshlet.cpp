@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "meshcache.h"
+#include "meshlet.h"
+
+namespace {
+// Weight of the angle between a candidate face and the mean normal of the meshlet, against the vertices it adds:
+// narrower normal cones cull more, for a few more meshlets.
+constexpr auto cone_weight = 4.0;
+
+auto bounds(Meshlet& m, const Meshlets& out, const std::span<const Vertex> vertices, const std::span<const int> indices, const std::vector<Vec3d>& normals) -> void {
+    auto lo = Vec3d(std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max());
+    auto hi = -1 * lo;
+    for(auto i = m.first_vertex; i < m.first_vertex + m.nvertices; i++) {
+        const auto p = vertices[out.vertices[i]].pos;
+        for(auto k = 0; k < 3; k++) {
+            lo[k] = std::min(lo[k], p[k]);
+            hi[k] = std::max(hi[k], p[k]);
+        }
+    }
+    m.center = (lo + hi) / 2;
+    m.radius = 0;
+    for(auto i = m.first_vertex; i < m.first_vertex + m.nvertices; i++) {
+        m.radius = std::max(m.radius, norm(vertices[out.vertices[i]].pos - m.center));
+    }
+
+    // faces with no area are never drawn and have no normal to bound
+    auto sum = Vec3d();
+    for(auto i = m.first_face; i < m.first_face + m.nfaces; i++) {
+        sum = sum + normals[out.faces[i]];
+    }
+    m.cone_axis  = norm(sum) > 0 ? normalized(sum) : Vec3d();
+    m.cone_sin   = 2;
+    m.apex_back  = 0;
+    m.apex_front = 0;
+    auto cos     = 1.0;
+    for(auto i = m.first_face; i < m.first_face + m.nfaces; i++) {
+        if(norm(normals[out.faces[i]]) > 0) cos = std::min(cos, normals[out.faces[i]] * m.cone_axis);
+    }
+    if(cos <= 0) return;
+    m.cone_sin = std::sqrt(1 - cos * cos);
+    // The plane of face f is at signed distance (p - center) * n along n from center, so center + t * cone_axis is
+    // behind it for t up to that over n * cone_axis, in front of it from there on.
+    m.apex_back  = std::numeric_limits<double>::max();
+    m.apex_front = std::numeric_limits<double>::lowest();
+    for(auto i = m.first_face; i < m.first_face + m.nfaces; i++) {
+        const auto& n = normals[out.faces[i]];
+        if(norm(n) == 0) continue;
+        const auto t = (vertices[indices[out.faces[i] * 3]].pos - m.center) * n / (n * m.cone_axis);
+        m.apex_back  = std::min(m.apex_back, t);
+        m.apex_front = std::max(m.apex_front, t);
+    }
+}
+} // namespace
+
+auto build_meshlets(const std::span<const Vertex> vertices, const std::span<const int> indices) -> Meshlets {
+    const auto nfaces = indices.size() / 3;
+    // faces around every vertex
+    auto first = std::vector<int>(vertices.size() + 1, 0);
+    for(auto i = 0uz; i < nfaces * 3; i++) {
+        first[indices[i] + 1]++;
+    }
+    for(auto v = 0uz; v < vertices.size(); v++) {
+        first[v + 1] += first[v];
+    }
+    auto adjacency = std::vector<int>(first.back());
+    auto fill      = std::vector<int>(first.begin(), first.end() - 1);
+    for(auto i = 0uz; i < nfaces * 3; i++) {
+        adjacency[fill[indices[i]]++] = int(i / 3);
+    }
+
+    // unit normals, zero for faces with no area
+    auto normals = std::vector<Vec3d>(nfaces);
+    for(auto f = 0uz; f < nfaces; f++) {
+        const auto& a = vertices[indices[f * 3]].pos;
+        const auto  n = cross(vertices[indices[f * 3 + 1]].pos - a, vertices[indices[f * 3 + 2]].pos - a);
+        normals[f]    = norm(n) > 0 ? normalized(n) : Vec3d();
+    }
+
+    auto out        = Meshlets();
+    auto assigned   = std::vector<bool>(nfaces, false);
+    auto slot       = std::vector<int>(vertices.size(), -1); // position of the vertex in the current meshlet, -1 if not in it
+    auto candidates = std::vector<int>();
+    // vertices of face f the current meshlet does not have yet
+    const auto new_vertices = [&](const int f) {
+        const auto a = indices[f * 3], b = indices[f * 3 + 1], c = indices[f * 3 + 2];
+        return int(slot[a] < 0) + int(slot[b] < 0 && b != a) + int(slot[c] < 0 && c != a && c != b);
+    };
+    for(auto seed = 0uz; seed < nfaces; seed++) {
+        if(assigned[seed]) continue;
+        auto m         = Meshlet{};
+        m.first_vertex = uint32_t(out.vertices.size());
+        m.first_face   = uint32_t(out.faces.size());
+        auto axis      = Vec3d();
+        candidates.assign(1, int(seed));
+        while(m.nfaces < meshlet_max_faces) {
+            auto best       = -1;
+            auto best_score = std::numeric_limits<double>::max();
+            std::erase_if(candidates, [&](const int f) { return assigned[f]; });
+            const auto mean = norm(axis) > 0 ? normalized(axis) : Vec3d();
+            for(const auto f : candidates) {
+                const auto n = new_vertices(f);
+                if(int(m.nvertices) + n > meshlet_max_vertices) continue;
+                const auto score = n + cone_weight * (1 - normals[f] * mean);
+                if(score < best_score || (score == best_score && f < best)) {
+                    best       = f;
+                    best_score = score;
+                }
+            }
+            if(best < 0) break;
+            axis           = axis + normals[best];
+            assigned[best] = true;
+            out.faces.push_back(best);
+            m.nfaces++;
+            for(auto k = 0; k < 3; k++) {
+                const auto v = indices[best * 3 + k];
+                if(slot[v] >= 0) continue;
+                slot[v] = int(m.nvertices++);
+                out.vertices.push_back(v);
+                for(auto j = first[v]; j < first[v + 1]; j++) {
+                    if(!assigned[adjacency[j]]) candidates.push_back(adjacency[j]);
+                }
+            }
+        }
+        for(auto i = m.first_vertex; i < m.first_vertex + m.nvertices; i++) {
+            slot[out.vertices[i]] = -1;
+        }
+        std::sort(out.faces.begin() + m.first_face, out.faces.end());
+        bounds(m, out, vertices, indices, normals);
+        out.meshlets.push_back(m);
+    }
+    return out;
+}
+
+auto facing_away(const Meshlet& m, const Vec3d eye, const bool reversed) -> bool {
+    // Every face is back-facing if the eye sees the apex behind all of them back-facing for any normal of the cone,
+    // i.e. if the direction from the eye to the apex is less than 90 degrees minus the half angle off the axis.
+    const auto d = m.center + m.cone_axis * (reversed ? m.apex_front : m.apex_back) - eye;
+    return (reversed ? -1 : 1) * (d * m.cone_axis) > (m.cone_sin + 1e-6) * norm(d);
+}
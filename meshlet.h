@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "geometry.h"
+
+struct Vertex;
+
+// A small cluster of adjacent faces, with bounds to cull it as a whole.
+struct Meshlet {
+    Vec3d    center;       // bounding sphere of the vertices
+    double   radius;
+    Vec3d    cone_axis;    // unit vector every face normal is within the cone half angle of
+    double   cone_sin;     // sine of the half angle, above 1 if the normals do not fit in a cone narrower than a half space
+    double   apex_back;    // center + apex_back * cone_axis is behind the plane of every face,
+    double   apex_front;   // center + apex_front * cone_axis in front of every one
+    uint32_t first_vertex; // range of the meshlet vertex array
+    uint32_t nvertices;
+    uint32_t first_face;   // range of the meshlet face array
+    uint32_t nfaces;
+};
+
+constexpr auto meshlet_max_vertices = 64;
+constexpr auto meshlet_max_faces    = 64;
+
+struct Meshlets {
+    std::vector<Meshlet> meshlets = {};
+    std::vector<int>     vertices = {}; // indices into the vertex buffer, each meshlet's in a range
+    std::vector<int>     faces    = {}; // face numbers, each meshlet's in a range, ascending within it
+};
+
+// Partitions the faces into meshlets of at most meshlet_max_vertices vertices and meshlet_max_faces faces.
+// A meshlet grows from the first unassigned face by the neighbour sharing most vertices with it,
+// so it stays compact; it ends when its faces have no unassigned neighbour that fits.
+auto build_meshlets(std::span<const Vertex> vertices, std::span<const int> indices) -> Meshlets;
+
+// True if every face of the meshlet points away from eye; with reversed, if every one points towards it.
+// Faces are counter-clockwise seen from the front.
+auto facing_away(const Meshlet& m, const Vec3d eye, const bool reversed = false) -> bool;
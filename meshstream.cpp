@@ -0,0 +1,256 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <numeric>
+#include <optional>
+#include <print>
+#include <span>
+#include <vector>
+
+#include "meshlet.h"
+#include "meshstream.h"
+#include "objfile.h"
+#include "vertexcache.h"
+
+namespace {
+constexpr auto magic   = std::array<char, 8>{'t', 'r', 's', 't', 'r', 'e', 'a', 'm'};
+constexpr auto version = uint32_t(1); // also catches streams written with the other byte order
+
+// Stream file format: this header in a CacheLine, then the batches, each a CacheLine with the size of its cache image
+// as a uint64_t followed by the image.
+struct Header {
+    std::array<char, 8> magic;
+    uint32_t            version;
+    uint32_t            reserved;
+    FileStamp           obj;
+    uint64_t            batch_faces;
+    uint64_t            nbatches;
+    uint64_t            nfaces;
+};
+static_assert(sizeof(Header) <= sizeof(CacheLine));
+
+using Triplet = std::array<int, 3>; // (v, vt, vn) of a corner
+
+template <typename T>
+auto write(std::ofstream& out, const std::span<const T> array) -> void {
+    out.write(reinterpret_cast<const char*>(array.data()), std::streamsize(array.size_bytes()));
+}
+
+// value in a CacheLine padded with zeros
+template <typename T>
+auto write_line(std::ofstream& out, const T& value) -> void {
+    auto line = CacheLine{};
+    std::memcpy(line.bytes, &value, sizeof(value));
+    write(out, std::span<const CacheLine>(&line, 1));
+}
+
+// Pass one: parses the text slice by slice, cut at line ends after slice_size bytes, and appends the attributes and the
+// corners, their indices made global, to files. False if a face is not a triangle.
+auto split_obj(const MappedFile& file, const size_t slice_size, std::array<std::ofstream, 4>& out, size_t& ncorners) -> bool {
+    const auto text = file.data();
+    auto       nv = 0uz, nvt = 0uz, nvn = 0uz;
+    for(auto first = 0uz; first < text.size();) {
+        const auto nl   = text.find('\n', std::min(first + slice_size, text.size()));
+        const auto last = nl == std::string_view::npos ? text.size() : nl + 1;
+        auto       obj  = ObjData();
+        const auto ok   = parse_obj(text.substr(first, last - first), obj);
+        // relative indices count back from the slice's own elements, like in a chunk of parse_obj_chunked
+        for(const auto r : obj.relative_vrt) obj.facet_vrt[r] += int(nv);
+        for(const auto r : obj.relative_tex) obj.facet_tex[r] += int(nvt);
+        for(const auto r : obj.relative_nrm) obj.facet_nrm[r] += int(nvn);
+        auto corners = std::vector<Triplet>(obj.facet_vrt.size());
+        for(auto i = 0uz; i < corners.size(); i++) {
+            corners[i] = {obj.facet_vrt[i], obj.facet_tex[i], obj.facet_nrm[i]};
+        }
+        write(out[0], std::span<const Vec3d>(obj.verts));
+        write(out[1], std::span<const Vec2d>(obj.tex));
+        write(out[2], std::span<const Vec3d>(obj.norms));
+        write(out[3], std::span<const Triplet>(corners));
+        nv += obj.verts.size();
+        nvt += obj.tex.size();
+        nvn += obj.norms.size();
+        ncorners += corners.size();
+        file.release(first, last - first);
+        if(!ok) return false;
+        first = last;
+    }
+    return true;
+}
+
+// Pass two, for one batch: collapses the corners into unique vertices numbered by first use, like unify_vertices,
+// and appends the batch to the stream.
+auto write_batch(const std::span<const Triplet> corners, const std::span<const Vec3d> verts, const std::span<const Vec2d> tex, const std::span<const Vec3d> norms, const FileStamp& obj, std::ofstream& out) -> void {
+    auto order = std::vector<int>(corners.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::ranges::stable_sort(order, {}, [&](const int i) { return corners[i]; });
+    auto indices = std::vector<int>(corners.size());
+    auto unique  = std::vector<Triplet>();
+    for(const auto i : order) {
+        if(unique.empty() || unique.back() != corners[i]) unique.push_back(corners[i]);
+        indices[i] = int(unique.size()) - 1;
+    }
+    const auto old      = renumber_by_first_use(indices, unique.size());
+    auto       vertices = std::vector<Vertex>(old.size());
+    const auto at       = [](const auto array, const int i) { return i >= 0 && size_t(i) < array.size() ? array[i] : typename decltype(array)::value_type{}; };
+    for(auto v = 0uz; v < old.size(); v++) {
+        const auto& t = unique[old[v]];
+        vertices[v]   = {at(verts, t[0]), at(tex, t[1]), at(norms, t[2])};
+    }
+    const auto clusters = build_meshlets(vertices, indices);
+    const auto view     = MeshView{
+            .vertices         = vertices,
+            .indices          = indices,
+            .meshlets         = clusters.meshlets,
+            .meshlet_vertices = clusters.vertices,
+            .meshlet_faces    = clusters.faces,
+    };
+    const auto image = write_mesh_cache(view, obj, {});
+    write_line(out, uint64_t(image.size() * sizeof(CacheLine)));
+    write(out, std::span<const CacheLine>(image));
+}
+
+template <typename T>
+auto array_of(const MappedFile& file) -> std::span<const T> {
+    return {reinterpret_cast<const T*>(file.data().data()), file.data().size() / sizeof(T)};
+}
+
+// Converts the .obj at obj_path into a stream at path, through a temporary file renamed over it.
+auto convert(const std::string& obj_path, const std::string& path, const FileStamp& stamp, const size_t batch_faces) -> bool {
+    const auto file = MappedFile(obj_path, false);
+    if(!file.is_open()) return false;
+    const auto tmp   = std::format("{}.{}.tmp", path, ::getpid());
+    const auto parts = std::array{tmp + ".v", tmp + ".vt", tmp + ".vn", tmp + ".f"}; // attributes and corners of pass one
+    const auto clean = [&] {
+        auto ec = std::error_code();
+        for(const auto& p : parts) std::filesystem::remove(p, ec);
+        std::filesystem::remove(tmp, ec);
+    };
+    auto ncorners = 0uz;
+    {
+        auto out = std::array<std::ofstream, 4>();
+        for(auto i = 0uz; i < parts.size(); i++) {
+            out[i].open(parts[i], std::ios::binary);
+        }
+        // a slice of text parses to about as many bytes again, a quarter of the budget for it leaves room
+        const auto ok = split_obj(file, std::max(batch_faces * stream_bytes_per_face / 4, 1uz), out, ncorners);
+        if(!ok) std::println(stderr, "error: obj file is supposed to be triangulated.");
+        if(!ok || !std::ranges::all_of(out, [](std::ofstream& o) { o.close(); return o.good(); })) {
+            clean();
+            return false;
+        }
+    }
+
+    const auto verts   = MappedFile(parts[0], false);
+    const auto tex     = MappedFile(parts[1], false);
+    const auto norms   = MappedFile(parts[2], false);
+    auto       in      = std::ifstream(parts[3], std::ios::binary);
+    auto       out     = std::ofstream(tmp, std::ios::binary);
+    auto       header  = Header{magic, version, 0, stamp, batch_faces, 0, ncorners / 3};
+    auto       corners = std::vector<Triplet>();
+    write_line(out, header);
+    for(auto done = 0uz; done < header.nfaces && in && out; done += batch_faces) {
+        corners.resize(std::min(batch_faces, header.nfaces - done) * 3);
+        in.read(reinterpret_cast<char*>(corners.data()), std::streamsize(corners.size() * sizeof(Triplet)));
+        write_batch(corners, array_of<Vec3d>(verts), array_of<Vec2d>(tex), array_of<Vec3d>(norms), stamp, out);
+        header.nbatches++;
+        // the vertices of a batch are read from wherever they are in the file, keep only those of the next one
+        for(const auto* f : {&verts, &tex, &norms}) {
+            f->release(0, f->data().size());
+        }
+    }
+    out.seekp(0);
+    write_line(out, header);
+    out.close();
+    auto       ec = std::error_code();
+    const auto ok = in && out.good();
+    if(ok) std::filesystem::rename(tmp, path, ec);
+    clean();
+    return ok && !ec;
+}
+
+// The stream at path if it is complete and was made from obj with batch_faces faces per batch, nullptr otherwise.
+auto open_stream(const std::string& path, const FileStamp& obj, const size_t batch_faces, size_t& nbatches, size_t& nfaces) -> std::unique_ptr<MappedFile> {
+    auto file = std::make_unique<MappedFile>(path, false);
+    if(!file->is_open()) return nullptr;
+    const auto data = file->data();
+    auto       h    = Header{};
+    if(data.size() < sizeof(CacheLine)) return nullptr;
+    std::memcpy(&h, data.data(), sizeof(h));
+    if(h.magic != magic || h.version != version || h.obj != obj || h.batch_faces != batch_faces) return nullptr;
+    // every batch must be there with a valid header; only the first cache line or two of every batch are touched, the
+    // arrays are checked by for_each_batch as it reads them
+    auto offset = sizeof(CacheLine);
+    auto faces  = 0uz;
+    for(auto b = 0uz; b < h.nbatches; b++) {
+        auto size = uint64_t(0);
+        if(data.size() - offset < sizeof(CacheLine)) return nullptr;
+        std::memcpy(&size, data.data() + offset, sizeof(size));
+        offset += sizeof(CacheLine);
+        if(size > data.size() - offset) return nullptr;
+        const auto view = read_mesh_cache(data.substr(offset, size), TriangleOrder::file, obj, {}, false);
+        if(!view) return nullptr;
+        faces += view->indices.size() / 3;
+        offset += size;
+    }
+    if(offset != data.size() || faces != h.nfaces) return nullptr;
+    file->release(0, data.size());
+    nbatches = h.nbatches;
+    nfaces   = h.nfaces;
+    return file;
+}
+} // namespace
+
+MeshStream::MeshStream(const std::string_view filepath, const size_t budget) : filepath(filepath) {
+    obj = file_stamp(this->filepath);
+    if(obj == FileStamp{}) {
+        std::println(stderr, "failed to open {}", filepath);
+        return;
+    }
+    const auto batch_faces = std::max(budget / stream_bytes_per_face, 1uz);
+    const auto path        = replace_extension(filepath, std::format(".{}.stream", batch_faces)); // one per batch size
+    if(path.empty()) {
+        std::println(stderr, "invalid filename: {}", filepath);
+        return;
+    }
+    file = open_stream(path, obj, batch_faces, nbatches_, nfaces_);
+    if(!file && convert(this->filepath, path, obj, batch_faces)) file = open_stream(path, obj, batch_faces, nbatches_, nfaces_);
+    if(!file) {
+        std::println(stderr, "failed to stream {}", filepath);
+        return;
+    }
+    std::println(stderr, "# f# {} batches# {} name# {}", nfaces_, nbatches_, filepath);
+}
+
+auto MeshStream::load_diffusemap(const bool mipmaps) -> bool {
+    const auto path = replace_extension(filepath, "_diffuse.tga");
+    auto       map  = TGAImage();
+    if(path.empty() || !map.read_tga_file(path)) {
+        std::println(stderr, "failed to load {}", path);
+        return false;
+    }
+    diffusemap = std::make_shared<const Texture>(map, mipmaps);
+    return true;
+}
+
+auto MeshStream::for_each_batch(const std::function<void(const Model&)>& f) const -> void {
+    if(!file) return;
+    const auto data   = file->data();
+    auto       offset = sizeof(CacheLine);
+    for(auto b = 0uz; b < nbatches_; b++) {
+        auto size = uint64_t(0);
+        std::memcpy(&size, data.data() + offset, sizeof(size));
+        const auto view = read_mesh_cache(data.substr(offset + sizeof(CacheLine), size), TriangleOrder::file, obj, {});
+        if(!view) {
+            std::println(stderr, "damaged batch {} in the stream of {}", b, filepath);
+            return;
+        }
+        f(Model(*view, diffusemap));
+        file->release(offset, sizeof(CacheLine) + size);
+        offset += sizeof(CacheLine) + size;
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "mappedfile.h"
+#include "meshcache.h"
+#include "model.h"
+#include "texture.h"
+
+// Rough bound of the memory a face costs while its batch is converted or drawn: the corners and the vertices they
+// collapse to, the batch's cache image, its meshlets, its screen vertices and its binned triangle.
+constexpr auto stream_bytes_per_face = 1024uz;
+constexpr auto default_stream_budget = 64uz << 20;
+
+// Out-of-core rendering of meshes too large to load at once. The .obj is converted once into a stream file next to
+// it, with a .<faces per batch>.stream extension: a sequence of self-contained batches of faces, each a mesh cache
+// image of its own (see meshcache.h) with the vertices of its faces and its meshlets. A batch has
+// budget / stream_bytes_per_face faces, and both the conversion and for_each_batch only hold about one batch in memory,
+// whatever the size of the model. Faces are in the order of the .obj; the stream is converted again if the .obj
+// changes. Every budget has a stream file of its own, so that switching budgets does not convert the .obj again.
+class MeshStream {
+    std::string                    filepath   = {};
+    std::unique_ptr<MappedFile>    file       = {};
+    FileStamp                      obj        = {};
+    size_t                         nbatches_  = 0;
+    size_t                         nfaces_    = 0;
+    std::shared_ptr<const Texture> diffusemap = std::make_shared<const Texture>();
+
+  public:
+    explicit MeshStream(std::string_view filepath, const size_t budget = default_stream_budget);
+    auto is_open() const -> bool { return file != nullptr; }
+    // the diffuse map is small next to the mesh and is loaded whole, see Model::load_diffusemap
+    auto load_diffusemap(const bool mipmaps = false) -> bool;
+    auto nbatches() const -> size_t { return nbatches_; }
+    auto nfaces() const -> size_t { return nfaces_; }
+    // Calls f with a Model over every batch in turn; the memory of a batch is released once f returns.
+    // Stops at a batch whose arrays refer to elements that are not there.
+    auto for_each_batch(const std::function<void(const Model&)>& f) const -> void;
+};
@@ -1,63 +1,78 @@
+#include <cstring>
 #include <filesystem>
-#include <fstream>
+#include <memory>
 #include <print>
-#include <ranges>
-#include <sstream>
+#include <span>
 #include <string>
+#include <thread>
 
 #include "geometry.h"
+#include "mappedfile.h"
+#include "meshcache.h"
+#include "meshlet.h"
 #include "model.h"
+#include "objfile.h"
+#include "texture.h"
 #include "tgaimage.h"
+#include "vertexcache.h"
 
-Model::Model(std::string_view filepath) {
-    auto in = std::ifstream(filepath.data());
-    if(!in) {
+Model::Model(std::string_view filepath, const TriangleOrder order) : filepath(filepath) {
+    const auto obj_stamp = file_stamp(this->filepath);
+    if(obj_stamp == FileStamp{}) {
         std::println(stderr, "failed to open {}", filepath);
         return;
     }
-    auto line = std::string();
-    while(!in.eof()) {
-        std::getline(in, line);
-        auto iss   = std::istringstream(line.data());
-        auto trash = char();
-        if(line.starts_with("v ")) {
-            // vertex
-            iss >> trash;
-            auto v = Vec3d{};
-            for(auto i : std::views::iota(0, 3)) {
-                iss >> v[i];
-            }
-            verts.push_back(v);
-        } else if(line.starts_with("vn ")) {
-            iss >> trash >> trash;
-            auto n = Vec3d{};
-            for(auto i : std::views::iota(0, 3)) {
-                iss >> n[i];
-            }
-            norms.push_back(normalized(n));
-        } else if(line.starts_with("vt ")) {
-            iss >> trash >> trash;
-            auto t = Vec2d{};
-            for(auto i : std::views::iota(0, 2)) {
-                iss >> t[i];
-            }
-            tex.push_back({t.x, 1 - t.y});
-        } else if(line.starts_with("f ")) {
-            auto f = 0, t = 0, n = 0, cnt = 0;
-            iss >> trash;
-            while(iss >> f >> trash >> t >> trash >> n) {
-                facet_vrt.push_back(f - 1);
-                facet_tex.push_back(t - 1);
-                facet_nrm.push_back(n - 1);
-                cnt++;
-            }
-            if(cnt != 3) {
-                std::println(stderr, "error: obj file is supposed to be triangulated.");
-                return;
+    const auto diffuse_path  = replace_extension(filepath, "_diffuse.tga");
+    const auto diffuse_stamp = file_stamp(diffuse_path);
+    const auto cache_path    = replace_extension(filepath, order == TriangleOrder::tipsify ? ".tipsify.mesh" : ".mesh");
+    if(auto mapped = std::make_unique<MappedFile>(cache_path); mapped->is_open()) {
+        if(const auto view = read_mesh_cache(mapped->data(), order, obj_stamp, diffuse_stamp)) {
+            mesh  = *view;
+            cache = std::move(mapped);
+        }
+    }
+    if(!cache) {
+        const auto file = MappedFile(this->filepath);
+        if(!file.is_open()) {
+            std::println(stderr, "failed to open {}", filepath);
+            return;
+        }
+        auto       obj      = ObjData();
+        const auto ok       = parse_obj_chunked(file.data(), obj, std::thread::hardware_concurrency());
+        auto       vertices = std::vector<Vertex>();
+        auto       indices  = std::vector<int>();
+        unify_vertices(obj, vertices, indices);
+        obj = ObjData();
+        if(order == TriangleOrder::tipsify) {
+            tipsify(std::span(indices).first(indices.size() / 3 * 3), vertices.size());
+            const auto old        = renumber_by_first_use(indices, vertices.size());
+            auto       renumbered = std::vector<Vertex>(old.size());
+            for(auto i = 0uz; i < old.size(); i++) {
+                renumbered[i] = vertices[old[i]];
             }
+            vertices = std::move(renumbered);
         }
+        const auto clusters  = build_meshlets(vertices, indices);
+        auto       src       = MeshView{.vertices = vertices, .indices = indices, .order = order};
+        src.meshlets         = clusters.meshlets;
+        src.meshlet_vertices = clusters.vertices;
+        src.meshlet_faces    = clusters.faces;
+        auto       map       = TGAImage();
+        if(ok && diffuse_stamp != FileStamp{} && map.read_tga_file(diffuse_path)) {
+            src.diffuse        = {map.buffer(), map.get_width() * map.get_height() * map.get_format()};
+            src.diffuse_width  = int(map.get_width());
+            src.diffuse_height = int(map.get_height());
+            src.diffuse_bpp    = map.get_format();
+        }
+        image = write_mesh_cache(src, obj_stamp, diffuse_stamp);
+        mesh  = *read_mesh_cache({reinterpret_cast<const char*>(image.data()), image.size() * sizeof(CacheLine)}, order, obj_stamp, diffuse_stamp);
+        if(!ok) {
+            std::println(stderr, "error: obj file is supposed to be triangulated.");
+            return;
+        }
+        if(!cache_path.empty()) save_mesh_cache(cache_path, std::as_bytes(std::span(image))); // best effort, e.g. the directory may be read-only
     }
-    std::println(stderr, "# v# {} f# {} vt# {} vn# {} name# {}", nverts(), nfaces(), tex.size(), norms.size(), filepath);
+    std::println(stderr, "# v# {} f# {} meshlets# {} acmr# {:.3f} name# {}", nverts(), nfaces(), meshlets().size(), acmr(), filepath);
     // Painter's algorithm (too slow)
     /*
         auto idx = [&] {auto ret = std::vector<int>(nfaces()); std::iota(ret.begin(), ret.end(), 0); return ret; }();
@@ -76,13 +91,14 @@ Model::Model(std::string_view filepath) {
     */
 }
 
+Model::Model(const MeshView& view, std::shared_ptr<const Texture> diffuse) : mesh(view), diffusemap(std::move(diffuse)) {}
+
 auto Model::load_texture(std::string_view obj_file, std::string_view suffix, TGAImage& img) -> bool {
-    const auto last_dot = obj_file.find_last_of(".");
-    if(last_dot == std::string::npos) {
+    const auto filepath = replace_extension(obj_file, suffix);
+    if(filepath.empty()) {
         std::println(stderr, "invalid filename: {}", obj_file);
         return false;
     }
-    const auto filepath = std::format("{}{}", obj_file.substr(0, last_dot), std::string(suffix));
     if(!std::filesystem::exists(filepath)) {
         std::println(stderr, "{} does not exists", filepath);
         return false;
@@ -94,19 +110,32 @@ auto Model::load_texture(std::string_view obj_file, std::string_view suffix, TGA
     return true;
 };
 
-auto Model::load_diffusemap(std::string_view obj_file) -> bool {
-    return load_texture(obj_file, "_diffuse.tga", diffusemap);
+auto Model::load_diffusemap(std::string_view obj_file, const bool mipmaps) -> bool {
+    auto map = TGAImage();
+    if(obj_file == filepath && !mesh.diffuse.empty()) {
+        map = TGAImage(mesh.diffuse_width, mesh.diffuse_height, TGAImage::Format(mesh.diffuse_bpp));
+        std::memcpy(map.buffer(), mesh.diffuse.data(), mesh.diffuse.size());
+    } else if(!load_texture(obj_file, "_diffuse.tga", map)) {
+        return false;
+    }
+    diffusemap = std::make_shared<const Texture>(map, mipmaps);
+    return true;
 }
 
-auto Model::nverts() const -> size_t { return verts.size(); }
-auto Model::nfaces() const -> size_t { return facet_vrt.size() / 3; }
-auto Model::vert(const int i) const -> Vec3d { return verts[i]; }
+auto Model::build_bvh(const unsigned nthreads) -> void { hierarchy = ::build_bvh(vertices(), indices(), nthreads); }
+auto Model::nverts() const -> size_t { return mesh.vertices.size(); }
+auto Model::nfaces() const -> size_t { return mesh.indices.size() / 3; }
+auto Model::vert(const int i) const -> Vec3d { return mesh.vertices[i].pos; }
 auto Model::vert(const int iface, const int nthvert) const -> Vec3d {
-    return verts[facet_vrt[iface * 3 + nthvert]];
+    return mesh.vertices[mesh.indices[iface * 3 + nthvert]].pos;
+}
+auto Model::vert_index(const int iface, const int nthvert) const -> int {
+    return mesh.indices[iface * 3 + nthvert];
 }
 auto Model::uv(const int iface, const int nthvert) const -> Vec2d {
-    return tex[facet_tex[iface * 3 + nthvert]];
+    return mesh.vertices[mesh.indices[iface * 3 + nthvert]].uv;
 }
 auto Model::normal(const int iface, const int nthvert) const -> Vec3d {
-    return norms[facet_nrm[iface * 3 + nthvert]];
+    return mesh.vertices[mesh.indices[iface * 3 + nthvert]].normal;
 }
+auto Model::acmr() const -> double { return ::acmr(mesh.indices.first(nfaces() * 3)); }
@@ -1,30 +1,60 @@
 #pragma once
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
 #include <string_view>
 #include <vector>
 
+#include "bvh.h"
 #include "geometry.h"
+#include "mappedfile.h"
+#include "meshcache.h"
+#include "texture.h"
 #include "tgaimage.h"
 
+// Loads a triangulated .obj through a binary mesh cache next to it: same name, .mesh extension for TriangleOrder::file,
+// .tipsify.mesh for TriangleOrder::tipsify, so that loading in one order never invalidates the cache of the other.
+// A cache made from the current .obj and diffuse map is mapped and used in place; otherwise the .obj is parsed
+// and the cache written again, with the diffuse map inlined so that load_diffusemap does not decode the TGA.
+// The (v, vt, vn) triplets of the faces are collapsed into unique vertices with a single index buffer,
+// so every attribute of a corner is one lookup away.
 class Model {
-    std::vector<Vec3d> verts     = {};
-    std::vector<Vec3d> norms     = {};
-    std::vector<Vec2d> tex       = {};
-    std::vector<int>   facet_vrt = {};
-    std::vector<int>   facet_nrm = {};
-    std::vector<int>   facet_tex = {};
+    std::string                 filepath  = {};
+    MeshView                    mesh      = {}; // points into cache or image
+    std::unique_ptr<MappedFile> cache     = {};
+    std::vector<CacheLine>      image     = {}; // cache image built from the .obj
+    Bvh                         hierarchy = {}; // empty until build_bvh
 
-    TGAImage diffusemap = {};
+    std::shared_ptr<const Texture> diffusemap = std::make_shared<const Texture>();
 
   public:
-    Model(std::string_view filepath);
+    Model(std::string_view filepath, const TriangleOrder order = TriangleOrder::file);
+    // A model over arrays that live elsewhere, e.g. a batch of a MeshStream, which must outlive it.
+    Model(const MeshView& view, std::shared_ptr<const Texture> diffuse);
     auto load_texture(const std::string_view obj_filename, const std::string_view suffix, TGAImage& img) -> bool;
-    auto load_diffusemap(const std::string_view obj_filename) -> bool;
+    // With mipmaps the map gets its chain of mipmaps, see Texture and gl::MipShader.
+    auto load_diffusemap(const std::string_view obj_filename, const bool mipmaps = false) -> bool;
+    // Builds the bounding volume hierarchy over the faces, for culling and ray or point queries. It is not cached.
+    auto build_bvh(const unsigned nthreads = std::thread::hardware_concurrency()) -> void;
+    auto bvh() const -> const Bvh& { return hierarchy; }
+    auto vertices() const -> std::span<const Vertex> { return mesh.vertices; }
+    auto indices() const -> std::span<const int> { return mesh.indices.first(nfaces() * 3); }
     auto nverts() const -> size_t;
     auto nfaces() const -> size_t;
     auto vert(const int i) const -> Vec3d;
+    // positions of the vertices as separate arrays, padded past nverts()
+    auto positions() const -> const PositionArrays& { return mesh.positions; }
+    // clusters of adjacent faces, see meshlet.h
+    auto meshlets() const -> std::span<const Meshlet> { return mesh.meshlets; }
+    auto meshlet_vertices() const -> std::span<const int> { return mesh.meshlet_vertices; }
+    auto meshlet_faces() const -> std::span<const int> { return mesh.meshlet_faces; }
     auto vert(const int iface, const int nthvert) const -> Vec3d;
+    auto vert_index(const int iface, const int nthvert) const -> int;
     auto uv(const int iface, const int nthvert) const -> Vec2d;
     auto normal(const int iface, const int nthvert) const -> Vec3d;
+    // average cache miss ratio of the faces in their current order, see vertexcache.h
+    auto acmr() const -> double;
 
-    const TGAImage& diffuse() const { return diffusemap; }
+    const Texture& diffuse() const { return *diffusemap; }
 };
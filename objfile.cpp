@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <memory>
+#include <span>
+#include <thread>
+
+#include "objfile.h"
+
+namespace {
+template <typename F>
+auto for_each_line(std::string_view text, F f) -> void {
+    while(!text.empty()) {
+        const auto nl = text.find('\n');
+        f(text.substr(0, nl));
+        if(nl == std::string_view::npos) break;
+        text.remove_prefix(nl + 1);
+    }
+}
+
+auto skip_blanks(const char*& p, const char* end) -> void {
+    while(p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+}
+
+// Plain decimals with at most 15 digits take Clinger's fast path: the digits and the power of ten are both exact doubles,
+// so a single correctly rounded division gives the same value as from_chars. Anything else goes to from_chars.
+auto parse_number(const char*& p, const char* end, double& value) -> bool {
+    static constexpr auto pow10 = std::array{1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+    skip_blanks(p, end);
+    if(p < end && *p == '+') p++;
+    auto*      q        = p;
+    const auto negative = q < end && *q == '-';
+    if(negative) q++;
+    auto mantissa = uint64_t(0);
+    auto digits   = 0;
+    auto decimals = 0;
+    for(; q < end && unsigned(*q - '0') < 10; q++, digits++) {
+        mantissa = mantissa * 10 + unsigned(*q - '0');
+    }
+    if(q < end && *q == '.') {
+        for(q++; q < end && unsigned(*q - '0') < 10; q++, digits++, decimals++) {
+            mantissa = mantissa * 10 + unsigned(*q - '0');
+        }
+    }
+    if(digits > 0 && digits <= 15 && !(q < end && (*q == 'e' || *q == 'E'))) {
+        value = double(mantissa) / pow10[decimals];
+        value = negative ? -value : value;
+        p     = q;
+        return true;
+    }
+    const auto [ptr, ec] = std::from_chars(p, end, value);
+    if(ec != std::errc()) return false;
+    p = ptr;
+    return true;
+}
+
+// face indices are short and plain, a digit loop beats from_chars on them
+auto parse_number(const char*& p, const char* end, int& value) -> bool {
+    skip_blanks(p, end);
+    const auto negative = p < end && *p == '-';
+    if(negative || (p < end && *p == '+')) p++;
+    const auto* first = p;
+    auto        v     = 0;
+    while(p < end && unsigned(*p - '0') < 10 && p - first < 9) {
+        v = v * 10 + (*p++ - '0');
+    }
+    if(p == first) return false;
+    value = negative ? -v : v;
+    return true;
+}
+
+auto parse_separator(const char*& p, const char* end) -> bool {
+    if(p == end || *p != '/') return false;
+    p++;
+    return true;
+}
+
+// Indices count from 1, negative ones back from the last element defined so far.
+auto push_index(const int i, const size_t count, std::vector<int>& facet, std::vector<size_t>& relative) -> void {
+    if(i < 0) relative.push_back(facet.size());
+    facet.push_back(i < 0 ? int(count) + i : i - 1);
+}
+
+// sizes the vectors from a quick count of the line types
+auto reserve_obj(const std::string_view text, ObjData& obj) -> void {
+    auto nv = 0uz, nvn = 0uz, nvt = 0uz, nf = 0uz;
+    for_each_line(text, [&](const std::string_view line) {
+        if(line.size() < 2) return;
+        if(line[0] == 'v') {
+            nv += line[1] == ' ';
+            nvn += line[1] == 'n';
+            nvt += line[1] == 't';
+        } else if(line[0] == 'f') {
+            nf += line[1] == ' ';
+        }
+    });
+    obj.verts.reserve(nv);
+    obj.norms.reserve(nvn);
+    obj.tex.reserve(nvt);
+    obj.facet_vrt.reserve(nf * 3);
+    obj.facet_nrm.reserve(nf * 3);
+    obj.facet_tex.reserve(nf * 3);
+}
+
+template <typename T>
+auto at_or_zero(const std::vector<T>& array, const int i) -> T {
+    return i >= 0 && size_t(i) < array.size() ? array[i] : T{};
+}
+
+// Files smaller than this are not worth a thread.
+constexpr auto min_chunk_size = 1uz << 20;
+
+// Appends the chunks to obj. Absolute indices are global in an OBJ file, relative ones are rebased by the number of
+// elements of the chunks before theirs. Chunks after the first failed one are dropped, like the sequential parse stops.
+auto merge_obj(std::vector<ObjData>& chunks, std::span<const bool> ok, ObjData& obj) -> bool {
+    const auto n     = std::min(size_t(std::ranges::find(ok, false) - ok.begin()) + 1, chunks.size());
+    const auto total = [&](auto member) {
+        auto sum = 0uz;
+        for(auto i = 0uz; i < n; i++) sum += std::invoke(member, chunks[i]).size();
+        return sum;
+    };
+    obj.verts.reserve(total(&ObjData::verts));
+    obj.norms.reserve(total(&ObjData::norms));
+    obj.tex.reserve(total(&ObjData::tex));
+    obj.facet_vrt.reserve(total(&ObjData::facet_vrt));
+    obj.facet_nrm.reserve(total(&ObjData::facet_nrm));
+    obj.facet_tex.reserve(total(&ObjData::facet_tex));
+    const auto append = [](auto& to, const auto& from) { to.insert(to.end(), from.begin(), from.end()); };
+    const auto rebase = [](std::vector<int>& facet, const std::vector<int>& from, const std::vector<size_t>& relative, const size_t base) {
+        const auto offset = facet.size() - from.size();
+        for(const auto r : relative) {
+            facet[offset + r] += int(base);
+        }
+    };
+    for(auto i = 0uz; i < n; i++) {
+        auto&      c  = chunks[i];
+        const auto nv = obj.verts.size(), nvn = obj.norms.size(), nvt = obj.tex.size();
+        append(obj.verts, c.verts);
+        append(obj.norms, c.norms);
+        append(obj.tex, c.tex);
+        append(obj.facet_vrt, c.facet_vrt);
+        append(obj.facet_nrm, c.facet_nrm);
+        append(obj.facet_tex, c.facet_tex);
+        rebase(obj.facet_vrt, c.facet_vrt, c.relative_vrt, nv);
+        rebase(obj.facet_nrm, c.facet_nrm, c.relative_nrm, nvn);
+        rebase(obj.facet_tex, c.facet_tex, c.relative_tex, nvt);
+        c = ObjData(); // release the chunk early, big files would need twice the memory otherwise
+    }
+    return n == chunks.size() && ok.back();
+}
+} // namespace
+
+auto parse_obj(const std::string_view text, ObjData& obj) -> bool {
+    auto ok = true;
+    for_each_line(text, [&](const std::string_view line) {
+        if(!ok) return;
+        auto*       p   = line.data();
+        const auto* end = line.data() + line.size();
+        if(line.starts_with("v ")) {
+            p += 2;
+            auto v = Vec3d{};
+            for(auto i = 0; i < 3; i++) {
+                parse_number(p, end, v[i]);
+            }
+            obj.verts.push_back(v);
+        } else if(line.starts_with("vn ")) {
+            p += 3;
+            auto n = Vec3d{};
+            for(auto i = 0; i < 3; i++) {
+                parse_number(p, end, n[i]);
+            }
+            obj.norms.push_back(normalized(n));
+        } else if(line.starts_with("vt ")) {
+            p += 3;
+            auto t = Vec2d{};
+            for(auto i = 0; i < 2; i++) {
+                parse_number(p, end, t[i]);
+            }
+            obj.tex.push_back({t.x, 1 - t.y});
+        } else if(line.starts_with("f ")) {
+            p += 2;
+            auto f = 0, t = 0, n = 0, cnt = 0;
+            while(parse_number(p, end, f) && parse_separator(p, end) && parse_number(p, end, t) && parse_separator(p, end) && parse_number(p, end, n)) {
+                push_index(f, obj.verts.size(), obj.facet_vrt, obj.relative_vrt);
+                push_index(t, obj.tex.size(), obj.facet_tex, obj.relative_tex);
+                push_index(n, obj.norms.size(), obj.facet_nrm, obj.relative_nrm);
+                cnt++;
+            }
+            ok = cnt == 3;
+        }
+    });
+    return ok;
+}
+
+auto replace_extension(const std::string_view path, const std::string_view suffix) -> std::string {
+    const auto last_dot = path.find_last_of(".");
+    if(last_dot == std::string_view::npos) return {};
+    return std::format("{}{}", path.substr(0, last_dot), suffix);
+}
+
+auto unify_vertices(const ObjData& obj, std::vector<Vertex>& vertices, std::vector<int>& indices) -> void {
+    using Triplet       = std::array<int, 3>;
+    const auto nbuckets = obj.verts.size() + 1; // vertices are chained by position, the last bucket for invalid ones
+    auto       head     = std::vector<int>(nbuckets, -1);
+    auto       next     = std::vector<int>();
+    auto       triplets = std::vector<Triplet>();
+    indices.resize(obj.facet_vrt.size());
+    for(auto i = 0uz; i < indices.size(); i++) {
+        const auto key    = Triplet{obj.facet_vrt[i], obj.facet_tex[i], obj.facet_nrm[i]};
+        const auto bucket = key[0] >= 0 && size_t(key[0]) < obj.verts.size() ? size_t(key[0]) : nbuckets - 1;
+        auto       j      = head[bucket];
+        while(j >= 0 && triplets[j] != key) {
+            j = next[j];
+        }
+        if(j < 0) {
+            j = int(vertices.size());
+            vertices.push_back({at_or_zero(obj.verts, key[0]), at_or_zero(obj.tex, key[1]), at_or_zero(obj.norms, key[2])});
+            triplets.push_back(key);
+            next.push_back(head[bucket]);
+            head[bucket] = j;
+        }
+        indices[i] = j;
+    }
+}
+
+auto parse_obj_chunked(const std::string_view text, ObjData& obj, const unsigned nthreads) -> bool {
+    const auto nchunks = std::clamp(text.size() / min_chunk_size, 1uz, size_t(std::max(nthreads, 1u)));
+    if(nchunks == 1) {
+        reserve_obj(text, obj);
+        return parse_obj(text, obj);
+    }
+    auto pieces = std::vector<std::string_view>();
+    for(auto i = 1uz, first = 0uz; i <= nchunks && first < text.size(); i++) {
+        auto last = i == nchunks ? std::string_view::npos : text.find('\n', std::max(first, text.size() * i / nchunks));
+        last      = last == std::string_view::npos ? text.size() : last + 1;
+        pieces.push_back(text.substr(first, last - first));
+        first = last;
+    }
+    auto       chunks = std::vector<ObjData>(pieces.size());
+    const auto ok     = std::make_unique<bool[]>(pieces.size());
+    const auto parse  = [&](const size_t i) {
+        reserve_obj(pieces[i], chunks[i]);
+        ok[i] = parse_obj(pieces[i], chunks[i]);
+    };
+    {
+        auto workers = std::vector<std::jthread>();
+        for(auto i = 1uz; i < pieces.size(); i++) {
+            workers.emplace_back(parse, i);
+        }
+        parse(0);
+    }
+    return merge_obj(chunks, {ok.get(), pieces.size()}, obj);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "geometry.h"
+#include "meshcache.h"
+
+// Elements of a Wavefront .obj as parsed, indices counting from 0. Only triangles are supported.
+struct ObjData {
+    std::vector<Vec3d> verts     = {};
+    std::vector<Vec3d> norms     = {};
+    std::vector<Vec2d> tex       = {};
+    std::vector<int>   facet_vrt = {};
+    std::vector<int>   facet_nrm = {};
+    std::vector<int>   facet_tex = {};
+    // positions in facet_* of relative (negative) indices, resolved against the elements parsed into this ObjData only
+    std::vector<size_t> relative_vrt = {};
+    std::vector<size_t> relative_nrm = {};
+    std::vector<size_t> relative_tex = {};
+};
+
+// Appends the elements of the text to obj; stops at the first face that is not a triangle and fails.
+auto parse_obj(const std::string_view text, ObjData& obj) -> bool;
+// Splits the text at line ends into up to nthreads chunks that are parsed concurrently, then merged in file order.
+// The result is the same as parse_obj on the whole text.
+auto parse_obj_chunked(const std::string_view text, ObjData& obj, const unsigned nthreads) -> bool;
+// Collapses the (v, vt, vn) triplets of the faces into unique vertices, numbered by first use.
+// Out-of-range indices, which a failed parse leaves behind, give zero attributes.
+auto unify_vertices(const ObjData& obj, std::vector<Vertex>& vertices, std::vector<int>& indices) -> void;
+// path with its extension replaced by suffix, empty if it has none
+auto replace_extension(const std::string_view path, const std::string_view suffix) -> std::string;
@@ -3,9 +3,12 @@
 #include <print>
 #include <random>
 
+#include "binner.h"
 #include "color.h"
+#include "depthbuffer.h"
 #include "geometry.h"
 #include "gl.h"
+#include "meshstream.h"
 #include "model.h"
 #include "tgaimage.h"
 
@@ -19,7 +22,7 @@ inline auto paint_sample_triangle(TGAImage& framebuffer) -> void {
     gl::triangle(triangle2, framebuffer, color::green);
 }
 
-inline auto paint_clown_model(TGAImage& zbuffer, TGAImage& framebuffer, const Model& model, const int width, const int height) -> void {
+inline auto paint_clown_model(gl::DepthBuffer& zbuffer, TGAImage& framebuffer, const Model& model, const int width, const int height) -> void {
     // clown colors, random
     for(auto i = 0u; i < model.nfaces(); i++) {
         const auto posa  = gl::project<int>(gl::perspective(gl::rotate(model.vert(i, 0))), width, height);
@@ -30,7 +33,7 @@ inline auto paint_clown_model(TGAImage& zbuffer, TGAImage& framebuffer, const Mo
     }
 }
 
-inline auto paint_illumination_model(TGAImage& zbuffer, TGAImage& framebuffer, const Model& model, const int width, const int height) -> void {
+inline auto paint_illumination_model(gl::DepthBuffer& zbuffer, TGAImage& framebuffer, const Model& model, const int width, const int height) -> void {
     // illmination from light_dir
     const auto light_dir = Vec3d(0, 0, -1);
     for(auto i = 0u; i < model.nfaces(); i++) {
@@ -51,7 +54,7 @@ inline auto paint_illumination_model(TGAImage& zbuffer, TGAImage& framebuffer, c
     }
 }
 
-inline auto paint_perspective_clown_model(std::vector<double>& zbuffer, TGAImage& framebuffer, const Model& model, const int width, const int height) {
+inline auto paint_perspective_clown_model(gl::DepthBuffer& zbuffer, TGAImage& framebuffer, const Model& model, const int width, const int height) {
     // viewport
     auto           rng    = std::mt19937(1);
     constexpr auto eye    = Vec3d(-1, 0, 2);
@@ -61,20 +64,36 @@ inline auto paint_perspective_clown_model(std::vector<double>& zbuffer, TGAImage
     gl::ModelView   = gl::lookat(eye, center, up);
     gl::Perspective = gl::perspective(norm(eye - center));
     gl::ViewPort    = gl::viewport(width / 16, height / 16, width * 7 / 8, height * 7 / 8);
+    auto binner     = gl::TileBinner<TGAColor>(width, height);
+    auto screen     = gl::ScreenVertices();
+    gl::transform_vertices(model, screen); // every vertex once, not once per face using it
     for(auto i = 0u; i < model.nfaces(); i++) {
-        auto clip = std::array<Vec4d, 3>();
-        for(auto d = 0u; d < clip.size(); d++) {
-            auto v  = model.vert(i, d);
-            clip[d] = gl::Perspective * gl::ModelView * Vec4d(v.x, v.y, v.z, 1.0);
-        }
         const auto rnd   = rng();
         const auto color = TGAColor((rnd >> 24) & 0xFF, (rnd >> 16) & 0xFF, (rnd >> 8) & 0xFF, rnd & 0xFF);
-        gl::triangle(clip, zbuffer, framebuffer, color);
+        binner.push_screen({screen[model.vert_index(i, 0)], screen[model.vert_index(i, 1)], screen[model.vert_index(i, 2)]}, color);
+    }
+    binner.draw(zbuffer, framebuffer);
+}
+
+// Culls the model's meshlets and bins its faces that may be visible with their varyings. screen and faces are scratch
+// space, kept by the caller so that they are not reallocated for every model.
+template <gl::ShaderConcept T>
+inline auto bin_visible_faces(const Model& model, const T& shader, const int width, const int height, gl::TileBinner<typename T::Varying>& binner, gl::ScreenVertices& screen, std::vector<int>& faces) -> void {
+    faces.clear();
+    gl::transform_meshlets(model, width, height, screen, faces);
+    for(const auto i : faces) {
+        auto screen_coords = std::array<vec4<gl::Real>, 3>();
+        auto varying       = typename T::Varying();
+        for(auto j = 0u; j < screen_coords.size(); j++) {
+            shader.varying(i, j, varying);
+            screen_coords[j] = screen[model.vert_index(i, j)];
+        }
+        binner.push_screen(screen_coords, varying);
     }
 }
 
 template <gl::ShaderConcept T>
-inline auto paint_perspective_with_diffusemap(std::vector<double>& zbuffer, TGAImage& framebuffer, const Model& model, const int width, const int height) {
+inline auto paint_perspective_with_diffusemap(gl::DepthBuffer& zbuffer, TGAImage& framebuffer, const Model& model, const int width, const int height, const gl::Shading shading = gl::Shading::forward) {
     //  viewport
     constexpr auto eye    = Vec3d(1, 1, 3);
     constexpr auto center = Vec3d(0, 0, 0);
@@ -83,31 +102,49 @@ inline auto paint_perspective_with_diffusemap(std::vector<double>& zbuffer, TGAI
     gl::ModelView   = gl::lookat(eye, center, up);
     gl::Perspective = gl::perspective(norm(eye - center));
     gl::ViewPort    = gl::viewport(width / 8, height / 8, width * 3 / 4, height * 3 / 4);
-    auto shader     = T(model);
-    for(auto i = 0u; i < model.nfaces(); i++) {
-        auto screen_coords = std::array<Vec4d, 3>();
-        for(auto j = 0u; j < screen_coords.size(); j++) {
-            screen_coords[j] = shader.vertex(i, j);
-        }
-        gl::triangle(screen_coords, shader, zbuffer, framebuffer);
-    }
+    const auto shader = T(model);
+    auto       binner = gl::TileBinner<typename T::Varying>(width, height);
+    auto       screen = gl::ScreenVertices();
+    auto       faces  = std::vector<int>();
+    bin_visible_faces(model, shader, width, height, binner, screen, faces);
+    binner.draw(shader, zbuffer, framebuffer, shading);
 }
 
+// paint_perspective_with_diffusemap for a mesh too large to load: every batch of the stream is culled, binned and drawn
+// into zbuffer and framebuffer before the next one is read.
 template <gl::ShaderConcept T>
-auto paint_diffuse_texture_with_eye(const Vec3d eye, std::vector<double>& zbuffer, TGAImage& framebuffer, const Model& model, const int width, const int height) {
+inline auto paint_perspective_stream_with_diffusemap(gl::DepthBuffer& zbuffer, TGAImage& framebuffer, const MeshStream& stream, const int width, const int height, const gl::Shading shading = gl::Shading::forward) {
     //  viewport
+    constexpr auto eye    = Vec3d(1, 1, 3);
     constexpr auto center = Vec3d(0, 0, 0);
     constexpr auto up     = Vec3d(0, 1, 0);
 
     gl::ModelView   = gl::lookat(eye, center, up);
     gl::Perspective = gl::perspective(norm(eye - center));
     gl::ViewPort    = gl::viewport(width / 8, height / 8, width * 3 / 4, height * 3 / 4);
-    auto shader     = T(model);
-    for(auto i = 0u; i < model.nfaces(); i++) {
-        auto screen_coords = std::array<Vec4d, 3>();
-        for(auto j = 0u; j < screen_coords.size(); j++) {
-            screen_coords[j] = shader.vertex(i, j);
-        }
-        gl::triangle(screen_coords, shader, zbuffer, framebuffer);
-    }
+    auto binner     = gl::TileBinner<typename T::Varying>(width, height);
+    auto screen     = gl::ScreenVertices();
+    auto faces      = std::vector<int>();
+    stream.for_each_batch([&](const Model& batch) {
+        const auto shader = T(batch);
+        bin_visible_faces(batch, shader, width, height, binner, screen, faces);
+        binner.draw(shader, zbuffer, framebuffer, shading);
+    });
+}
+
+template <gl::ShaderConcept T>
+auto paint_diffuse_texture_with_eye(const Vec3d eye, gl::DepthBuffer& zbuffer, TGAImage& framebuffer, const Model& model, const int width, const int height, const gl::Shading shading = gl::Shading::forward) {
+    //  viewport
+    constexpr auto center = Vec3d(0, 0, 0);
+    constexpr auto up     = Vec3d(0, 1, 0);
+
+    gl::ModelView   = gl::lookat(eye, center, up);
+    gl::Perspective = gl::perspective(norm(eye - center));
+    gl::ViewPort    = gl::viewport(width / 8, height / 8, width * 3 / 4, height * 3 / 4);
+    const auto shader = T(model);
+    auto       binner = gl::TileBinner<typename T::Varying>(width, height);
+    auto       screen = gl::ScreenVertices();
+    auto       faces  = std::vector<int>();
+    bin_visible_faces(model, shader, width, height, binner, screen, faces);
+    binner.draw(shader, zbuffer, framebuffer, shading);
 }
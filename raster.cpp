@@ -0,0 +1,598 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+#include <optional>
+
+#if !defined(GL_FORCE_SCALAR) && (defined(__x86_64__) || defined(__i386__))
+#define GL_HAS_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#include "depthbuffer.h"
+#include "geometry.h"
+#include "gl.h"
+#include "raster.h"
+
+namespace gl {
+namespace {
+constexpr auto subpixel_bits = 8;
+constexpr auto subpixel_one  = int64_t(1) << subpixel_bits;
+constexpr auto fixed_limit   = double(1 << 22);          // in pixels, keeps every edge product inside int64
+
+// keys of one DepthBuffer tile, addressed with image coordinates
+struct DepthTile {
+    uint32_t* keys;
+    Vec2i     origin;
+    Real      scale;
+
+    auto at(const int x, const int y) const -> uint32_t* { return keys + (x - origin.x) + (y - origin.y) * DepthBuffer::tile_size; }
+};
+
+auto clip_to_tile(const TriangleSetup& s, const Tile& tile, Vec2i& bbmin, Vec2i& bbmax) -> bool {
+    bbmin = Vec2i(std::max(s.bbmin.x, tile.bbmin.x), std::max(s.bbmin.y, tile.bbmin.y));
+    bbmax = Vec2i(std::min(s.bbmax.x, tile.bbmax.x), std::min(s.bbmax.y, tile.bbmax.y));
+    return bbmin.x <= bbmax.x && bbmin.y <= bbmax.y;
+}
+
+template <DepthFormat F>
+auto rasterize_scalar(const TriangleSetup& s, const Vec2i bbmin, const Vec2i bbmax, const DepthTile zt, const bool write_depth, std::vector<Fragment>& frags) -> void {
+    auto row = std::array<int64_t, 3>();
+    for(auto i = 0; i < 3; i++) {
+        row[i] = s.a[i] * bbmin.x + s.b[i] * bbmin.y + s.c[i];
+    }
+    for(auto y = bbmin.y; y <= bbmax.y; y++) {
+        auto w = row;
+        for(auto x = bbmin.x; x <= bbmax.x; x++) {
+            if(((w[0] - s.wmin[0]) | (w[1] - s.wmin[1]) | (w[2] - s.wmin[2])) >= 0) {
+                auto bc_clip   = vec3<Real>(Real(w[0]) * s.inv_w[0], Real(w[1]) * s.inv_w[1], Real(w[2]) * s.inv_w[2]);
+                bc_clip        = bc_clip / (bc_clip.x + bc_clip.y + bc_clip.z);
+                const auto key = encode_depth<F>(bc_clip * vec3<Real>(s.z[0], s.z[1], s.z[2]), zt.scale);
+                auto&      old = *zt.at(x, y);
+                if(!(key > old)) {
+                    if(write_depth) old = key;
+                    frags.push_back({x, y, bc_clip, key});
+                }
+            }
+            for(auto i = 0; i < 3; i++) {
+                w[i] += s.a[i];
+            }
+        }
+        for(auto i = 0; i < 3; i++) {
+            row[i] += s.b[i];
+        }
+    }
+}
+
+#ifdef GL_HAS_X86_KERNELS
+// The kernels step the edge equations in a narrower type than int64, which is exact as long as every value
+// in the block-aligned bounding box stays below limit. The edge equations are affine, so checking the corners is enough.
+auto fits(const TriangleSetup& s, const Vec2i bbmin, const Vec2i bbmax, const int block_w, const int block_h, const int64_t limit) -> bool {
+    const auto x0 = bbmin.x & ~(block_w - 1);
+    const auto y0 = bbmin.y & ~(block_h - 1);
+    const auto x1 = x0 + (bbmax.x - x0) / block_w * block_w + block_w - 1;
+    const auto y1 = y0 + (bbmax.y - y0) / block_h * block_h + block_h - 1;
+    for(auto i = 0; i < 3; i++) {
+        for(const auto x : {x0, x1}) {
+            for(const auto y : {y0, y1}) {
+                if(std::abs(s.a[i] * x + s.b[i] * y + s.c[i]) >= limit) return false;
+            }
+        }
+    }
+    return true;
+}
+
+auto emit(const unsigned mask, const int x, const int y, const Real* bc0, const Real* bc1, const Real* bc2, const uint32_t* keys, std::vector<Fragment>& frags) -> void {
+    for(auto m = mask; m; m &= m - 1) {
+        const auto j = std::countr_zero(m);
+        frags.push_back({x + j, y, vec3<Real>(bc0[j], bc1[j], bc2[j]), keys[j]});
+    }
+}
+
+// Blocks are aligned to their width and tiles to tile_size, so the depth keys of a whole block row lie inside the tile
+// even where the block sticks out of the bounding box; they are loaded and stored unmasked.
+// Keys are below 2^31, which makes the signed int32 compare an unsigned one.
+
+#ifndef GL_USE_FLOAT
+// double pipeline: 4x2 pixel blocks, edge values stepped as doubles (exact below 2^52)
+constexpr auto block_w    = 4;
+constexpr auto block_h    = 2;
+constexpr auto edge_limit = int64_t(1) << 52;
+
+// keys of two depths in the low lanes, same rounding as encode_depth
+template <DepthFormat F>
+auto encode_sse2(const __m128d d, const __m128d scale) -> __m128i {
+    const auto zero = _mm_setzero_pd();
+    if constexpr(F == DepthFormat::float32) {
+        return _mm_castps_si128(_mm_cvtpd_ps(_mm_max_pd(d, zero)));
+    } else {
+        return _mm_cvtpd_epi32(_mm_min_pd(_mm_max_pd(_mm_mul_pd(d, scale), zero), _mm_set1_pd(unorm24_max)));
+    }
+}
+
+template <DepthFormat F>
+auto rasterize_sse2(const TriangleSetup& s, const Vec2i bbmin, const Vec2i bbmax, const DepthTile zt, const bool write_depth, std::vector<Fragment>& frags) -> void {
+    const auto x0    = bbmin.x & ~(block_w - 1);
+    const auto y0    = bbmin.y & ~(block_h - 1);
+    const auto xmin  = _mm_set1_pd(bbmin.x);
+    const auto xmax  = _mm_set1_pd(bbmax.x);
+    const auto lane  = std::array{_mm_set_pd(1, 0), _mm_set_pd(3, 2)};
+    const auto scale = _mm_set1_pd(zt.scale);
+    __m128d    a[3], b[3], a4[3], wmin[3], inv_w[3], z[3];
+    for(auto i = 0; i < 3; i++) {
+        a[i]     = _mm_set1_pd(double(s.a[i]));
+        b[i]     = _mm_set1_pd(double(s.b[i]));
+        a4[i]    = _mm_set1_pd(double(s.a[i] * block_w));
+        wmin[i]  = _mm_set1_pd(double(s.wmin[i]));
+        inv_w[i] = _mm_set1_pd(s.inv_w[i]);
+        z[i]     = _mm_set1_pd(s.z[i]);
+    }
+    alignas(16) double   bc[3][block_w];
+    alignas(16) uint32_t keys[block_w];
+    for(auto by = y0; by <= bbmax.y; by += block_h) {
+        __m128d row[2][3];
+        for(auto i = 0; i < 3; i++) {
+            const auto origin = _mm_set1_pd(double(s.a[i] * x0 + s.b[i] * by + s.c[i]));
+            for(auto h = 0; h < 2; h++) {
+                row[h][i] = _mm_add_pd(origin, _mm_mul_pd(lane[h], a[i]));
+            }
+        }
+        for(auto bx = x0; bx <= bbmax.x; bx += block_w) {
+            for(auto dy = 0; dy < block_h; dy++) {
+                const auto y = by + dy;
+                if(y < bbmin.y || y > bbmax.y) continue;
+                auto    cover  = 0u;
+                __m128i key[2] = {_mm_setzero_si128(), _mm_setzero_si128()};
+                for(auto h = 0; h < 2; h++) {
+                    const auto xs  = _mm_add_pd(_mm_set1_pd(bx), lane[h]);
+                    auto       cov = _mm_and_pd(_mm_cmpge_pd(xs, xmin), _mm_cmple_pd(xs, xmax));
+                    __m128d    w[3];
+                    for(auto i = 0; i < 3; i++) {
+                        w[i] = dy ? _mm_add_pd(row[h][i], b[i]) : row[h][i];
+                        cov  = _mm_and_pd(cov, _mm_cmpge_pd(w[i], wmin[i]));
+                    }
+                    const auto covmask = unsigned(_mm_movemask_pd(cov));
+                    if(!covmask) continue;
+                    const auto u0  = _mm_mul_pd(w[0], inv_w[0]);
+                    const auto u1  = _mm_mul_pd(w[1], inv_w[1]);
+                    const auto u2  = _mm_mul_pd(w[2], inv_w[2]);
+                    const auto sum = _mm_add_pd(_mm_add_pd(u0, u1), u2);
+                    const auto bc0 = _mm_div_pd(u0, sum);
+                    const auto bc1 = _mm_div_pd(u1, sum);
+                    const auto bc2 = _mm_div_pd(u2, sum);
+                    const auto d   = _mm_add_pd(_mm_add_pd(_mm_mul_pd(bc2, z[2]), _mm_mul_pd(bc1, z[1])), _mm_mul_pd(bc0, z[0]));
+                    key[h]         = encode_sse2<F>(d, scale);
+                    cover |= covmask << (2 * h);
+                    _mm_store_pd(bc[0] + 2 * h, bc0);
+                    _mm_store_pd(bc[1] + 2 * h, bc1);
+                    _mm_store_pd(bc[2] + 2 * h, bc2);
+                }
+                if(!cover) continue;
+                auto*      zp   = reinterpret_cast<__m128i*>(zt.at(bx, y));
+                const auto knew = _mm_unpacklo_epi64(key[0], key[1]);
+                const auto kold = _mm_loadu_si128(zp);
+                const auto pass = cover & ~unsigned(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(knew, kold))));
+                if(!pass) continue;
+                if(write_depth) {
+                    const auto ok = _mm_cmpgt_epi32(_mm_and_si128(_mm_set1_epi32(int(pass)), _mm_setr_epi32(1, 2, 4, 8)), _mm_setzero_si128());
+                    _mm_storeu_si128(zp, _mm_or_si128(_mm_and_si128(ok, knew), _mm_andnot_si128(ok, kold)));
+                }
+                _mm_store_si128(reinterpret_cast<__m128i*>(keys), knew);
+                emit(pass, bx, y, bc[0], bc[1], bc[2], keys, frags);
+            }
+            for(auto h = 0; h < 2; h++) {
+                for(auto i = 0; i < 3; i++) {
+                    row[h][i] = _mm_add_pd(row[h][i], a4[i]);
+                }
+            }
+        }
+    }
+}
+
+template <DepthFormat F>
+__attribute__((target("avx2"))) auto rasterize_avx2(const TriangleSetup& s, const Vec2i bbmin, const Vec2i bbmax, const DepthTile zt, const bool write_depth, std::vector<Fragment>& frags) -> void {
+    const auto x0    = bbmin.x & ~(block_w - 1);
+    const auto y0    = bbmin.y & ~(block_h - 1);
+    const auto xmin  = _mm256_set1_pd(bbmin.x);
+    const auto xmax  = _mm256_set1_pd(bbmax.x);
+    const auto lane  = _mm256_set_pd(3, 2, 1, 0);
+    const auto scale = _mm256_set1_pd(zt.scale);
+    const auto zero  = _mm256_setzero_pd();
+    const auto even  = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+    __m256d    b[3], a4[3], wmin[3], inv_w[3], z[3], steps[3];
+    for(auto i = 0; i < 3; i++) {
+        b[i]     = _mm256_set1_pd(double(s.b[i]));
+        a4[i]    = _mm256_set1_pd(double(s.a[i] * block_w));
+        wmin[i]  = _mm256_set1_pd(double(s.wmin[i]));
+        inv_w[i] = _mm256_set1_pd(s.inv_w[i]);
+        z[i]     = _mm256_set1_pd(s.z[i]);
+        steps[i] = _mm256_mul_pd(lane, _mm256_set1_pd(double(s.a[i])));
+    }
+    alignas(32) double   bc[3][block_w];
+    alignas(16) uint32_t keys[block_w];
+    for(auto by = y0; by <= bbmax.y; by += block_h) {
+        __m256d row[3];
+        for(auto i = 0; i < 3; i++) {
+            row[i] = _mm256_add_pd(_mm256_set1_pd(double(s.a[i] * x0 + s.b[i] * by + s.c[i])), steps[i]);
+        }
+        for(auto bx = x0; bx <= bbmax.x; bx += block_w) {
+            const auto xs  = _mm256_add_pd(_mm256_set1_pd(bx), lane);
+            const auto xin = _mm256_and_pd(_mm256_cmp_pd(xs, xmin, _CMP_GE_OQ), _mm256_cmp_pd(xs, xmax, _CMP_LE_OQ));
+            for(auto dy = 0; dy < block_h; dy++) {
+                const auto y = by + dy;
+                if(y < bbmin.y || y > bbmax.y) continue;
+                auto    cov = xin;
+                __m256d w[3];
+                for(auto i = 0; i < 3; i++) {
+                    w[i] = dy ? _mm256_add_pd(row[i], b[i]) : row[i];
+                    cov  = _mm256_and_pd(cov, _mm256_cmp_pd(w[i], wmin[i], _CMP_GE_OQ));
+                }
+                if(!_mm256_movemask_pd(cov)) continue;
+                const auto u0  = _mm256_mul_pd(w[0], inv_w[0]);
+                const auto u1  = _mm256_mul_pd(w[1], inv_w[1]);
+                const auto u2  = _mm256_mul_pd(w[2], inv_w[2]);
+                const auto sum = _mm256_add_pd(_mm256_add_pd(u0, u1), u2);
+                const auto bc0 = _mm256_div_pd(u0, sum);
+                const auto bc1 = _mm256_div_pd(u1, sum);
+                const auto bc2 = _mm256_div_pd(u2, sum);
+                const auto d   = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(bc2, z[2]), _mm256_mul_pd(bc1, z[1])), _mm256_mul_pd(bc0, z[0]));
+                __m128i    knew;
+                if constexpr(F == DepthFormat::float32) {
+                    knew = _mm_castps_si128(_mm256_cvtpd_ps(_mm256_max_pd(d, zero)));
+                } else {
+                    knew = _mm256_cvtpd_epi32(_mm256_min_pd(_mm256_max_pd(_mm256_mul_pd(d, scale), zero), _mm256_set1_pd(unorm24_max)));
+                }
+                auto*      zp   = reinterpret_cast<__m128i*>(zt.at(bx, y));
+                const auto kold = _mm_loadu_si128(zp);
+                const auto cov4 = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(cov), even));
+                const auto ok   = _mm_andnot_si128(_mm_cmpgt_epi32(knew, kold), cov4);
+                const auto m    = unsigned(_mm_movemask_ps(_mm_castsi128_ps(ok)));
+                if(!m) continue;
+                if(write_depth) _mm_storeu_si128(zp, _mm_blendv_epi8(kold, knew, ok));
+                _mm256_store_pd(bc[0], bc0);
+                _mm256_store_pd(bc[1], bc1);
+                _mm256_store_pd(bc[2], bc2);
+                _mm_store_si128(reinterpret_cast<__m128i*>(keys), knew);
+                emit(m, bx, y, bc[0], bc[1], bc[2], keys, frags);
+            }
+            for(auto i = 0; i < 3; i++) {
+                row[i] = _mm256_add_pd(row[i], a4[i]);
+            }
+        }
+    }
+}
+#else
+// float pipeline: 8x1 (AVX2) or 4x1 (SSE2) pixel blocks, edge values stepped as int32
+constexpr auto block_w_sse2 = 4;
+constexpr auto block_w_avx2 = 8;
+constexpr auto block_h      = 1;
+constexpr auto edge_limit   = int64_t(1) << 31;
+
+template <DepthFormat F>
+auto rasterize_sse2(const TriangleSetup& s, const Vec2i bbmin, const Vec2i bbmax, const DepthTile zt, const bool write_depth, std::vector<Fragment>& frags) -> void {
+    constexpr auto block_w = block_w_sse2;
+    const auto     x0      = bbmin.x & ~(block_w - 1);
+    const auto     lane    = _mm_setr_epi32(0, 1, 2, 3);
+    const auto     xmin    = _mm_set1_epi32(bbmin.x - 1);
+    const auto     xmax    = _mm_set1_epi32(bbmax.x + 1);
+    const auto     scale   = _mm_set1_ps(zt.scale);
+    const auto     zero    = _mm_setzero_ps();
+    __m128i        aw[3], wbias[3], steps[3];
+    __m128         inv_w[3], z[3];
+    for(auto i = 0; i < 3; i++) {
+        aw[i]    = _mm_set1_epi32(int32_t(s.a[i] * block_w));
+        wbias[i] = _mm_set1_epi32(int32_t(s.wmin[i] - 1));
+        steps[i] = _mm_setr_epi32(0, int32_t(s.a[i]), int32_t(s.a[i] * 2), int32_t(s.a[i] * 3));
+        inv_w[i] = _mm_set1_ps(s.inv_w[i]);
+        z[i]     = _mm_set1_ps(s.z[i]);
+    }
+    alignas(16) float    bc[3][block_w];
+    alignas(16) uint32_t keys[block_w];
+    for(auto y = bbmin.y; y <= bbmax.y; y++) {
+        __m128i w[3];
+        for(auto i = 0; i < 3; i++) {
+            w[i] = _mm_add_epi32(_mm_set1_epi32(int32_t(s.a[i] * x0 + s.b[i] * y + s.c[i])), steps[i]);
+        }
+        for(auto bx = x0; bx <= bbmax.x; bx += block_w) {
+            const auto xs  = _mm_add_epi32(_mm_set1_epi32(bx), lane);
+            auto       cov = _mm_and_si128(_mm_cmpgt_epi32(xs, xmin), _mm_cmpgt_epi32(xmax, xs));
+            for(auto i = 0; i < 3; i++) {
+                cov = _mm_and_si128(cov, _mm_cmpgt_epi32(w[i], wbias[i]));
+            }
+            if(_mm_movemask_ps(_mm_castsi128_ps(cov))) {
+                const auto u0  = _mm_mul_ps(_mm_cvtepi32_ps(w[0]), inv_w[0]);
+                const auto u1  = _mm_mul_ps(_mm_cvtepi32_ps(w[1]), inv_w[1]);
+                const auto u2  = _mm_mul_ps(_mm_cvtepi32_ps(w[2]), inv_w[2]);
+                const auto sum = _mm_add_ps(_mm_add_ps(u0, u1), u2);
+                const auto bc0 = _mm_div_ps(u0, sum);
+                const auto bc1 = _mm_div_ps(u1, sum);
+                const auto bc2 = _mm_div_ps(u2, sum);
+                const auto d   = _mm_add_ps(_mm_add_ps(_mm_mul_ps(bc2, z[2]), _mm_mul_ps(bc1, z[1])), _mm_mul_ps(bc0, z[0]));
+                __m128i    knew;
+                if constexpr(F == DepthFormat::float32) {
+                    knew = _mm_castps_si128(_mm_max_ps(d, zero));
+                } else {
+                    knew = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(d, scale), zero), _mm_set1_ps(unorm24_max)));
+                }
+                auto*      zp   = reinterpret_cast<__m128i*>(zt.at(bx, y));
+                const auto kold = _mm_loadu_si128(zp);
+                const auto ok   = _mm_andnot_si128(_mm_cmpgt_epi32(knew, kold), cov);
+                const auto m    = unsigned(_mm_movemask_ps(_mm_castsi128_ps(ok)));
+                if(m) {
+                    if(write_depth) _mm_storeu_si128(zp, _mm_or_si128(_mm_and_si128(ok, knew), _mm_andnot_si128(ok, kold)));
+                    _mm_store_ps(bc[0], bc0);
+                    _mm_store_ps(bc[1], bc1);
+                    _mm_store_ps(bc[2], bc2);
+                    _mm_store_si128(reinterpret_cast<__m128i*>(keys), knew);
+                    emit(m, bx, y, bc[0], bc[1], bc[2], keys, frags);
+                }
+            }
+            for(auto i = 0; i < 3; i++) {
+                w[i] = _mm_add_epi32(w[i], aw[i]);
+            }
+        }
+    }
+}
+
+template <DepthFormat F>
+__attribute__((target("avx2"))) auto rasterize_avx2(const TriangleSetup& s, const Vec2i bbmin, const Vec2i bbmax, const DepthTile zt, const bool write_depth, std::vector<Fragment>& frags) -> void {
+    constexpr auto block_w = block_w_avx2;
+    const auto     x0      = bbmin.x & ~(block_w - 1);
+    const auto     lane    = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const auto     xmin    = _mm256_set1_epi32(bbmin.x - 1);
+    const auto     xmax    = _mm256_set1_epi32(bbmax.x + 1);
+    const auto     scale   = _mm256_set1_ps(zt.scale);
+    const auto     zero    = _mm256_setzero_ps();
+    __m256i        aw[3], wbias[3], steps[3];
+    __m256         inv_w[3], z[3];
+    for(auto i = 0; i < 3; i++) {
+        const auto a = s.a[i];
+        aw[i]        = _mm256_set1_epi32(int32_t(a * block_w));
+        wbias[i]     = _mm256_set1_epi32(int32_t(s.wmin[i] - 1));
+        steps[i]     = _mm256_setr_epi32(0, int32_t(a), int32_t(a * 2), int32_t(a * 3), int32_t(a * 4), int32_t(a * 5), int32_t(a * 6), int32_t(a * 7));
+        inv_w[i]     = _mm256_set1_ps(s.inv_w[i]);
+        z[i]         = _mm256_set1_ps(s.z[i]);
+    }
+    alignas(32) float    bc[3][block_w];
+    alignas(32) uint32_t keys[block_w];
+    for(auto y = bbmin.y; y <= bbmax.y; y++) {
+        __m256i w[3];
+        for(auto i = 0; i < 3; i++) {
+            w[i] = _mm256_add_epi32(_mm256_set1_epi32(int32_t(s.a[i] * x0 + s.b[i] * y + s.c[i])), steps[i]);
+        }
+        for(auto bx = x0; bx <= bbmax.x; bx += block_w) {
+            const auto xs  = _mm256_add_epi32(_mm256_set1_epi32(bx), lane);
+            auto       cov = _mm256_and_si256(_mm256_cmpgt_epi32(xs, xmin), _mm256_cmpgt_epi32(xmax, xs));
+            for(auto i = 0; i < 3; i++) {
+                cov = _mm256_and_si256(cov, _mm256_cmpgt_epi32(w[i], wbias[i]));
+            }
+            if(_mm256_movemask_ps(_mm256_castsi256_ps(cov))) {
+                const auto u0  = _mm256_mul_ps(_mm256_cvtepi32_ps(w[0]), inv_w[0]);
+                const auto u1  = _mm256_mul_ps(_mm256_cvtepi32_ps(w[1]), inv_w[1]);
+                const auto u2  = _mm256_mul_ps(_mm256_cvtepi32_ps(w[2]), inv_w[2]);
+                const auto sum = _mm256_add_ps(_mm256_add_ps(u0, u1), u2);
+                const auto bc0 = _mm256_div_ps(u0, sum);
+                const auto bc1 = _mm256_div_ps(u1, sum);
+                const auto bc2 = _mm256_div_ps(u2, sum);
+                const auto d   = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(bc2, z[2]), _mm256_mul_ps(bc1, z[1])), _mm256_mul_ps(bc0, z[0]));
+                __m256i    knew;
+                if constexpr(F == DepthFormat::float32) {
+                    knew = _mm256_castps_si256(_mm256_max_ps(d, zero));
+                } else {
+                    knew = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(d, scale), zero), _mm256_set1_ps(unorm24_max)));
+                }
+                auto*      zp   = reinterpret_cast<__m256i*>(zt.at(bx, y));
+                const auto kold = _mm256_loadu_si256(zp);
+                const auto ok   = _mm256_andnot_si256(_mm256_cmpgt_epi32(knew, kold), cov);
+                const auto m    = unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(ok)));
+                if(m) {
+                    if(write_depth) _mm256_storeu_si256(zp, _mm256_blendv_epi8(kold, knew, ok));
+                    _mm256_store_ps(bc[0], bc0);
+                    _mm256_store_ps(bc[1], bc1);
+                    _mm256_store_ps(bc[2], bc2);
+                    _mm256_store_si256(reinterpret_cast<__m256i*>(keys), knew);
+                    emit(m, bx, y, bc[0], bc[1], bc[2], keys, frags);
+                }
+            }
+            for(auto i = 0; i < 3; i++) {
+                w[i] = _mm256_add_epi32(w[i], aw[i]);
+            }
+        }
+    }
+}
+#endif
+#endif
+
+auto detect_isa() -> Isa {
+#ifdef GL_HAS_X86_KERNELS
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return Isa::avx2;
+    if(__builtin_cpu_supports("sse2")) return Isa::sse2;
+#endif
+    return Isa::scalar;
+}
+} // namespace
+
+namespace {
+auto setup_part(const std::array<vec4<Real>, 3>& t) -> std::optional<TriangleSetup> {
+    auto s   = TriangleSetup{};
+    auto pos = std::array<Vec2l, 3>();
+    for(auto i = 0; i < 3; i++) {
+        const auto pt = t[i];
+        const auto x  = pt.x / pt.w;
+        const auto y  = pt.y / pt.w;
+        if(!(std::abs(x) < fixed_limit && std::abs(y) < fixed_limit)) return std::nullopt; // NaN or outside the guard band
+        pos[i]     = Vec2l(std::llround(x * subpixel_one), std::llround(y * subpixel_one));
+        s.inv_w[i] = 1 / pt.w;
+        s.z[i]     = t[i].z;
+    }
+    for(auto i = 0; i < 3; i++) {
+        const auto& p1 = pos[(i + 1) % 3];
+        const auto& p2 = pos[(i + 2) % 3];
+        s.a[i]         = p1.y - p2.y;
+        s.b[i]         = p2.x - p1.x;
+        s.c[i]         = p1.x * p2.y - p2.x * p1.y;
+    }
+    const auto area2 = s.c[0] + s.c[1] + s.c[2]; // twice the signed area, in squared fixed-point units, positive for front faces
+    const auto back  = area2 < 0;
+    if(std::abs(area2) < subpixel_one * subpixel_one) return std::nullopt; // thinner than half a pixel
+    if((back && Culling == CullMode::back) || (!back && Culling == CullMode::front)) return std::nullopt;
+    for(auto i = 0; i < 3; i++) {
+        if(back) { // negating all edge functions keeps the barycentrics and makes the inside positive
+            s.a[i] = -s.a[i];
+            s.b[i] = -s.b[i];
+            s.c[i] = -s.c[i];
+        }
+        s.wmin[i] = (s.a[i] > 0 || (s.a[i] == 0 && s.b[i] > 0)) ? 0 : 1;
+        s.a[i] *= subpixel_one;
+        s.b[i] *= subpixel_one;
+    }
+    // interpolated depth stays within the vertex depths when all w share a sign; leave room for rounding
+    const auto zmin = std::min({s.z[0], s.z[1], s.z[2]});
+    const auto same = (s.inv_w[0] > 0) == (s.inv_w[1] > 0) && (s.inv_w[1] > 0) == (s.inv_w[2] > 0);
+    s.zmin          = same ? zmin - std::abs(zmin) * 16 * std::numeric_limits<Real>::epsilon() : -std::numeric_limits<Real>::infinity();
+
+    const auto [minx, maxx] = std::minmax({pos[0].x, pos[1].x, pos[2].x});
+    const auto [miny, maxy] = std::minmax({pos[0].y, pos[1].y, pos[2].y});
+    s.bbmin                 = Vec2i((minx + subpixel_one - 1) >> subpixel_bits, (miny + subpixel_one - 1) >> subpixel_bits);
+    s.bbmax                 = Vec2i(maxx >> subpixel_bits, maxy >> subpixel_bits);
+    return s;
+}
+
+struct ClipVertex {
+    vec4<Real> pos;
+    vec3<Real> bc; // barycentric coordinates in the submitted triangle, linear in homogeneous space
+};
+
+// a convex polygon with room for a triangle clipped by five planes
+struct ClipPolygon {
+    std::array<ClipVertex, 8> v;
+    int                       n = 0;
+};
+
+// Sutherland-Hodgman against the half-space distance(v) >= 0; distance must be linear in homogeneous coordinates
+template <typename F>
+auto clip(const ClipPolygon& in, F distance) -> ClipPolygon {
+    auto out = ClipPolygon();
+    for(auto i = 0; i < in.n; i++) {
+        const auto& a  = in.v[i];
+        const auto& b  = in.v[(i + 1) % in.n];
+        const auto  da = distance(a.pos);
+        const auto  db = distance(b.pos);
+        if(da >= 0) out.v[out.n++] = a;
+        if((da >= 0) != (db >= 0)) {
+            const auto k   = da / (da - db);
+            out.v[out.n++] = {a.pos + (b.pos - a.pos) * k, a.bc + (b.bc - a.bc) * k};
+        }
+    }
+    return out;
+}
+} // namespace
+
+auto setup_triangle(const std::array<vec4<Real>, 3>& t, std::vector<TriangleSetup>& out) -> void {
+    // guard band test, valid only in front of the near plane where every w has the sign of the first
+    const auto in_front = [](const vec4<Real>& v) { return v.z >= near_plane; };
+    const auto in_band  = [](const vec4<Real>& v) { return std::abs(v.x) < guard_band * std::abs(v.w) && std::abs(v.y) < guard_band * std::abs(v.w); };
+    if(std::ranges::all_of(t, in_front) && std::ranges::all_of(t, in_band)) {
+        if(auto s = setup_part(t)) out.push_back(*s);
+        return;
+    }
+    auto poly = ClipPolygon{{{{t[0], {1, 0, 0}}, {t[1], {0, 1, 0}}, {t[2], {0, 0, 1}}}}, 3};
+    poly      = clip(poly, [](const vec4<Real>& v) { return v.z - near_plane; });
+    if(poly.n < 3) return;
+    // x / w <= guard_band becomes sign * (guard_band * w - x) >= 0, with sign the sign of every w past the near plane
+    const auto sign = poly.v[0].pos.w < 0 ? Real(-1) : Real(1);
+    poly            = clip(poly, [&](const vec4<Real>& v) { return sign * (guard_band * v.w - v.x); });
+    poly            = clip(poly, [&](const vec4<Real>& v) { return sign * (guard_band * v.w + v.x); });
+    poly            = clip(poly, [&](const vec4<Real>& v) { return sign * (guard_band * v.w - v.y); });
+    poly            = clip(poly, [&](const vec4<Real>& v) { return sign * (guard_band * v.w + v.y); });
+    for(auto i = 1; i + 1 < poly.n; i++) {
+        const auto& v0 = poly.v[0];
+        const auto& v1 = poly.v[i];
+        const auto& v2 = poly.v[i + 1];
+        if(auto s = setup_part({v0.pos, v1.pos, v2.pos})) {
+            s->clipped   = true;
+            s->bc_parent = {{v0.bc, v1.bc, v2.bc}};
+            out.push_back(*s);
+        }
+    }
+}
+
+auto rasterizer_isa() -> Isa {
+    static const auto isa = detect_isa();
+    return isa;
+}
+
+namespace {
+template <DepthFormat F>
+auto rasterize_rect(const TriangleSetup& s, const Vec2i bbmin, const Vec2i bbmax, const DepthTile zt, const bool write_depth, std::vector<Fragment>& frags) -> void {
+#ifdef GL_HAS_X86_KERNELS
+    const auto isa = rasterizer_isa();
+#ifdef GL_USE_FLOAT
+    if(isa == Isa::avx2 && fits(s, bbmin, bbmax, block_w_avx2, block_h, edge_limit)) {
+        rasterize_avx2<F>(s, bbmin, bbmax, zt, write_depth, frags);
+        return;
+    }
+    if(isa != Isa::scalar && fits(s, bbmin, bbmax, block_w_sse2, block_h, edge_limit)) {
+        rasterize_sse2<F>(s, bbmin, bbmax, zt, write_depth, frags);
+        return;
+    }
+#else
+    if(isa != Isa::scalar && fits(s, bbmin, bbmax, block_w, block_h, edge_limit)) {
+        if(isa == Isa::avx2) {
+            rasterize_avx2<F>(s, bbmin, bbmax, zt, write_depth, frags);
+        } else {
+            rasterize_sse2<F>(s, bbmin, bbmax, zt, write_depth, frags);
+        }
+        return;
+    }
+#endif
+#endif
+    rasterize_scalar<F>(s, bbmin, bbmax, zt, write_depth, frags);
+}
+
+// rasterizes the part of the triangle inside one depth tile, skipping blocks it is entirely behind
+template <DepthFormat F>
+auto rasterize_tile(const TriangleSetup& s, const Vec2i bbmin, const Vec2i bbmax, DepthBuffer& depth, const int tx, const int ty, const bool write_depth, std::vector<Fragment>& frags) -> void {
+    constexpr auto n    = DepthBuffer::block_size;
+    const auto     zt   = DepthTile{depth.tile(tx, ty), Vec2i(tx * DepthBuffer::tile_size, ty * DepthBuffer::tile_size), depth.get_scale()};
+    const auto     zmin = encode_depth<F>(s.zmin, zt.scale);
+    // rasterize runs of consecutive blocks the triangle may be visible in, one block row at a time
+    for(auto by = bbmin.y / n; by <= bbmax.y / n; by++) {
+        const auto y0 = std::max(bbmin.y, by * n);
+        const auto y1 = std::min(bbmax.y, by * n + n - 1);
+        for(auto bx = bbmin.x / n; bx <= bbmax.x / n; bx++) {
+            if(zmin > depth.farthest(bx, by)) continue;
+            const auto first = bx;
+            while(bx + 1 <= bbmax.x / n && !(zmin > depth.farthest(bx + 1, by))) {
+                bx++;
+            }
+            rasterize_rect<F>(s, Vec2i(std::max(bbmin.x, first * n), y0), Vec2i(std::min(bbmax.x, bx * n + n - 1), y1), zt, write_depth, frags);
+        }
+    }
+}
+} // namespace
+
+auto rasterize(const TriangleSetup& s, const Tile& tile, DepthBuffer& depth, const bool write_depth, std::vector<Fragment>& frags) -> void {
+    auto bbmin = Vec2i(), bbmax = Vec2i();
+    if(!clip_to_tile(s, tile, bbmin, bbmax)) return;
+    constexpr auto n          = DepthBuffer::tile_size;
+    const auto     first_frag = frags.size();
+    for(auto ty = bbmin.y / n; ty <= bbmax.y / n; ty++) {
+        for(auto tx = bbmin.x / n; tx <= bbmax.x / n; tx++) {
+            const auto tmin = Vec2i(std::max(bbmin.x, tx * n), std::max(bbmin.y, ty * n));
+            const auto tmax = Vec2i(std::min(bbmax.x, tx * n + n - 1), std::min(bbmax.y, ty * n + n - 1));
+            if(depth.get_format() == DepthFormat::float32) {
+                rasterize_tile<DepthFormat::float32>(s, tmin, tmax, depth, tx, ty, write_depth, frags);
+            } else {
+                rasterize_tile<DepthFormat::unorm24>(s, tmin, tmax, depth, tx, ty, write_depth, frags);
+            }
+        }
+    }
+    if(s.clipped) {
+        for(auto i = first_frag; i < frags.size(); i++) {
+            frags[i].bc_clip = frags[i].bc_clip * s.bc_parent;
+        }
+    }
+}
+} // namespace gl
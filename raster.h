@@ -0,0 +1,128 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "depthbuffer.h"
+#include "geometry.h"
+#include "gl.h"
+#include "imageview.h"
+#include "tgaimage.h"
+
+namespace gl {
+// Edge equations of a screen-space triangle in 24.8 fixed point, evaluated at integer pixel positions.
+// w[i](x, y) = a[i] * x + b[i] * y + c[i] is twice the signed area of the sub-triangle opposite to vertex i,
+// so the three of them are the unnormalized screen-space barycentric coordinates.
+struct TriangleSetup {
+    Vec2i                  bbmin;
+    Vec2i                  bbmax;
+    std::array<int64_t, 3> a;
+    std::array<int64_t, 3> b;
+    std::array<int64_t, 3> c;
+    std::array<int64_t, 3> wmin; // 0 for top-left edges, 1 for the others (top-left fill rule)
+    std::array<Real, 3>    inv_w;
+    std::array<Real, 3>    z;
+    Real                   zmin; // no interpolated depth of the triangle is nearer than this
+    bool                   clipped;
+    mat<3, 3, Real>        bc_parent; // if clipped, row i holds the barycentric coordinates of corner i in the submitted triangle
+};
+
+// Depth (view distance) of the near plane. Geometry nearer than this, including everything behind the eye, is clipped away.
+constexpr auto near_plane = Real(1e-3);
+// Half extent in pixels of the guard band around the origin of the screen.
+// Triangles in front of the near plane and inside the band are rasterized without clipping;
+// the scissor to the tile does the rest.
+constexpr auto guard_band = Real(1 << 21);
+
+// A covered pixel that passed the depth test.
+struct Fragment {
+    int        x;
+    int        y;
+    vec3<Real> bc_clip;
+    uint32_t   depth; // key, see encode_depth
+};
+
+enum class Isa {
+    scalar,
+    sse2,
+    avx2,
+};
+
+// Appends the set-up parts of a triangle to out: nothing if it is culled or clipped away, several if it is clipped.
+// t in screen coordinates (after the viewport transform, before the perspective division).
+auto setup_triangle(const std::array<vec4<Real>, 3>& t, std::vector<TriangleSetup>& out) -> void;
+
+// Appends to frags every pixel of the triangle inside the tile that passes the depth test against the depth buffer.
+// Barycentric coordinates of the fragments refer to the submitted triangle, also for clipped parts.
+// If write_depth is set, the depth of those pixels is stored as well; otherwise it is left to the caller,
+// e.g. because the fragment shader may still discard the pixel.
+// Blocks the triangle is entirely behind are skipped; recomputing their farthest depth after writes is left to the caller.
+// Uses the widest kernel the CPU supports unless GL_FORCE_SCALAR is defined; all kernels give the same result.
+auto rasterize(const TriangleSetup& s, const Tile& tile, DepthBuffer& depth, const bool write_depth, std::vector<Fragment>& frags) -> void;
+auto rasterizer_isa() -> Isa;
+
+// recomputes the farthest depth of the blocks the fragments were written to
+auto update_blocks(DepthBuffer& depth, const std::vector<Fragment>& frags) -> void;
+
+// gl::triangle for a triangle that is already set up
+auto triangle(const TriangleSetup& s, DepthBuffer& zbuffer, TGAImage& image, const TGAColor& color, const Tile& tile) -> void;
+
+// Barycentric coordinates in the submitted triangle at pixel (x, y), also outside the triangle.
+inline auto barycentric(const TriangleSetup& s, const int x, const int y) -> vec3<Real> {
+    auto bc = vec3<Real>();
+    for(auto i = 0; i < 3; i++) {
+        bc[i] = Real(s.a[i] * x + s.b[i] * y + s.c[i]) * s.inv_w[i];
+    }
+    bc = bc / (bc.x + bc.y + bc.z);
+    return s.clipped ? bc * s.bc_parent : bc;
+}
+
+// Runs the fragment shader for pixel (x, y) of the triangle, bc its barycentric coordinates. A DerivativeShader also gets
+// the differences of the barycentric coordinates across the 2x2 quad of pixels (x, y) is in, the same for all four.
+template <ShaderConcept T>
+auto shade(const TriangleSetup& s, const T& shader, const typename T::Varying& varying, const int x, const int y, const vec3<Real> bc, PackedColor& color) -> bool {
+    if constexpr(DerivativeShader<T>) {
+        const auto qx     = x & ~1;
+        const auto qy     = y & ~1;
+        const auto origin = barycentric(s, qx, qy);
+        return shader.fragment(varying, bc, barycentric(s, qx + 1, qy) - origin, barycentric(s, qx, qy + 1) - origin, color);
+    } else {
+        return shader.fragment(varying, bc, color);
+    }
+}
+
+// Shaded triangles are templates so that fragment() is inlined into the pixel loop.
+// The shader is only read, so several threads can draw with the same instance as long as their tiles do not overlap.
+template <ShaderConcept T>
+auto triangle(const TriangleSetup& s, const T& shader, const typename T::Varying& varying, DepthBuffer& zbuffer, TGAImage& image, const Tile& tile) -> void {
+    thread_local auto frags = std::vector<Fragment>();
+    frags.clear();
+    rasterize(s, tile, zbuffer, false, frags);
+    visit_pixels(image, [&](const auto pixels) {
+        for(const auto& f : frags) {
+            auto color = PackedColor();
+            if(shade(s, shader, varying, f.x, f.y, f.bc_clip, color)) continue;
+            zbuffer.key(f.x, f.y) = f.depth;
+            pixels.set(f.x, f.y, color);
+        }
+    });
+    update_blocks(zbuffer, frags);
+}
+
+// t in clip coordinates
+template <ShaderConcept T>
+auto triangle(const std::array<vec4<Real>, 3> t, const T& shader, const typename T::Varying& varying, DepthBuffer& zbuffer, TGAImage& image, const Tile& tile) -> void {
+    thread_local auto setups = std::vector<TriangleSetup>();
+    setups.clear();
+    setup_triangle({gl::ViewPort * t[0], gl::ViewPort * t[1], gl::ViewPort * t[2]}, setups);
+    for(const auto& s : setups) {
+        triangle(s, shader, varying, zbuffer, image, tile);
+    }
+}
+
+template <ShaderConcept T>
+auto triangle(const std::array<vec4<Real>, 3> t, const T& shader, const typename T::Varying& varying, DepthBuffer& zbuffer, TGAImage& image) -> void {
+    triangle(t, shader, varying, zbuffer, image, Tile{{0, 0}, {int(image.get_width()) - 1, int(image.get_height()) - 1}});
+}
+} // namespace gl
@@ -19,7 +19,7 @@ auto main(const int argc, const char* argv[]) -> int {
     const auto filepath    = std::filesystem::path(argv[1]);
     const auto model       = Model(filepath.string());
     auto       framebuffer = TGAImage(width, height, TGAImage::RGB);
-    auto       zbuffer     = std::vector<double>(width * height, std::numeric_limits<double>::max());
+    auto       zbuffer     = gl::DepthBuffer(width, height);
     paint_perspective_clown_model(zbuffer, framebuffer, model, width, height);
 
     const auto output = GEN_TEST_OUTPUT_NAME(filepath, ".tga");
@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "imageview.h"
+#include "texture.h"
+
+namespace {
+// levels at least this large are built on several threads
+constexpr auto parallel_texels = 1 << 16;
+} // namespace
+
+Texture::Texture() {
+    add_level(1, 1);
+}
+
+Texture::Texture(const TGAImage& image, const bool mipmaps, const unsigned nthreads) : format(image.get_format()) {
+    const auto width  = int(image.get_width());
+    const auto height = int(image.get_height());
+    if(width == 0 || height == 0) {
+        *this = Texture();
+        return;
+    }
+    add_level(width, height);
+    // texels past the right and bottom edges of a level are never sampled and stay zero
+    visit_pixels(image, [&](const auto pixels) {
+        for(auto y = 0; y < height; y++) {
+            for(auto x = 0; x < width; x++) {
+                tiles[(y / tile_size) * levels[0].ntiles_x + x / tile_size].texels[(y % tile_size) * tile_size + x % tile_size] = pixels.get(x, y).bits();
+            }
+        }
+    });
+    if(!mipmaps) return;
+    for(auto w = width, h = height; w > 1 || h > 1;) {
+        w = std::max(w / 2, 1);
+        h = std::max(h / 2, 1);
+        add_level(w, h);
+    }
+    for(auto i = 1; i < nlevels(); i++) {
+        build_level(i, std::max(nthreads, 1u));
+    }
+}
+
+auto Texture::add_level(const int width, const int height) -> void {
+    const auto ntiles_x = (width + tile_size - 1) / tile_size;
+    const auto ntiles_y = (height + tile_size - 1) / tile_size;
+    levels.push_back({tiles.size(), width, height, ntiles_x});
+    tiles.resize(tiles.size() + size_t(ntiles_x) * size_t(ntiles_y));
+}
+
+// Every texel the rounded average of the texels under it in the level above: 2x2 of them, 3 across in the last column
+// (row) of a level made from an odd width (height), so that every texel above is in the average of one below, and 1
+// across where the level above is already 1 texel wide (high).
+auto Texture::build_level(const int level, const unsigned nthreads) -> void {
+    const auto& l     = levels[level];
+    const auto& above = levels[level - 1];
+    const auto  rows  = [&](const int begin, const int end) {
+        for(auto y = begin; y < end; y++) {
+            for(auto x = 0; x < l.width; x++) {
+                // texels [x0, x1) x [y0, y1) of the level above
+                const auto x0  = 2 * x, x1 = x == l.width - 1 ? above.width : 2 * x + 2;
+                const auto y0  = 2 * y, y1 = y == l.height - 1 ? above.height : 2 * y + 2;
+                const auto n   = uint32_t((x1 - x0) * (y1 - y0));
+                auto       sum = std::array<uint32_t, 4>();
+                for(auto v = y0; v < y1; v++) {
+                    for(auto u = x0; u < x1; u++) {
+                        const auto texel = get(u, v, level - 1);
+                        for(auto k = 0; k < 4; k++) sum[k] += (texel >> (8 * k)) & 0xFF;
+                    }
+                }
+                auto c = uint32_t(0);
+                for(auto k = 0; k < 4; k++) {
+                    c |= (sum[k] + n / 2) / n << (8 * k);
+                }
+                auto& tile = tiles[l.first + (y / tile_size) * l.ntiles_x + x / tile_size];
+                tile.texels[(y % tile_size) * tile_size + x % tile_size] = c;
+            }
+        }
+    };
+    // threads take whole rows of tiles, so that none writes to the cache lines of another
+    const auto ntile_rows = (l.height + tile_size - 1) / tile_size;
+    const auto n          = l.width * l.height >= parallel_texels ? std::min(int(nthreads), ntile_rows) : 1;
+    auto       workers    = std::vector<std::jthread>();
+    for(auto i = 1; i < n; i++) {
+        workers.emplace_back(rows, std::min(l.height, ntile_rows * i / n * tile_size), std::min(l.height, ntile_rows * (i + 1) / n * tile_size));
+    }
+    rows(0, std::min(l.height, ntile_rows / n * tile_size));
+}
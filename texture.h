@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "tgaimage.h"
+
+enum class Wrap {
+    clamp,  // coordinates outside [0, 1) take the texel at the nearest edge
+    repeat, // the texture tiles the plane
+};
+
+// A texture for sampling, made from an image: 4x4 tiles of 4-byte texels, a cache line each and row by row, so that
+// neighbouring texels are close in memory whatever direction the sampler walks in. Texels are laid out like
+// TGAColor::raw, channels the image does not have are zero. A texture without an image has one black texel, like the
+// color TGAImage::get gives for pixels out of range.
+// Optionally it has a chain of mipmaps, level i + 1 box filtered from level i down to a single texel, for sampling
+// minified textures from a level whose texels are about the size of a pixel.
+class Texture {
+  public:
+    static constexpr auto tile_size = 4;
+
+  private:
+    struct alignas(64) Tile {
+        uint32_t texels[tile_size * tile_size];
+    };
+    struct Level {
+        size_t first; // of its tiles
+        int    width;
+        int    height;
+        int    ntiles_x;
+    };
+
+    std::vector<Tile>  tiles  = {}; // of every level, level 0 first
+    std::vector<Level> levels = {};
+    TGAImage::Format   format = TGAImage::GRAYSCALE;
+
+    auto add_level(const int width, const int height) -> void;
+    auto build_level(const int level, const unsigned nthreads) -> void;
+
+    // max first and min second, so that NaN ends up at lo
+    template <std::floating_point T>
+    static auto clamp(const T x, const T lo, const T hi) -> T {
+        return std::min(hi, std::max(lo, x));
+    }
+    // fraction of u in [0, 1)
+    template <std::floating_point T>
+    static auto repeat(const T u) -> T {
+        const auto t = clamp(u, T(-(1 << 30)), T(1 << 30)); // int range for the truncation
+        const auto f = t - T(int(t));                        // in (-1, 1)
+        return f + T(f < 0);
+    }
+    // texel column (or row) of texture coordinate u across size texels
+    template <Wrap wrap, std::floating_point T>
+    static auto texel(const T u, const int size) -> int {
+        const auto t = wrap == Wrap::repeat ? repeat(u) : u;
+        return int(clamp(t * T(size), T(0), T(size - 1)));
+    }
+    // the two texel columns (or rows) whose centers are either side of texture coordinate u, and the weight of x1
+    template <Wrap wrap, std::floating_point T>
+    static auto texels(const T u, const int size, int& x0, int& x1) -> T {
+        if constexpr(wrap == Wrap::repeat) {
+            const auto t = repeat(u) * T(size) + T(size) - T(0.5); // in [size - 0.5, 2 size - 0.5), no negative truncation
+            x0           = int(t);
+            const auto w = t - T(x0);
+            x0 -= size * (x0 >= size);
+            x1 = x0 + 1 - size * (x0 + 1 >= size);
+            return w;
+        } else {
+            const auto t = clamp(u * T(size) - T(0.5), T(0), T(size - 1));
+            x0           = int(t);
+            x1           = std::min(x0 + 1, size - 1);
+            return t - T(x0);
+        }
+    }
+    // adds weight times the bilinearly filtered texel of the level at (u, v) to the channels in c
+    template <Wrap wrap, std::floating_point T>
+    auto bilinear(const int level, const T u, const T v, const T weight, T (&c)[4]) const -> void {
+        const auto& l  = levels[level];
+        auto        x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+        const auto  wx = texels<wrap>(u, l.width, x0, x1);
+        const auto  wy = texels<wrap>(v, l.height, y0, y1);
+        const auto  t  = std::array{get(x0, y0, level), get(x1, y0, level), get(x0, y1, level), get(x1, y1, level)};
+        const auto  w  = std::array{(1 - wx) * (1 - wy), wx * (1 - wy), (1 - wx) * wy, wx * wy};
+        for(auto i = 0; i < 4; i++) {
+            for(auto k = 0; k < 4; k++) {
+                c[k] += weight * w[i] * T((t[i] >> (8 * k)) & 0xFF);
+            }
+        }
+    }
+
+  public:
+    Texture();
+    // With mipmaps, builds the chain on up to nthreads threads; the result does not depend on nthreads.
+    explicit Texture(const TGAImage& image, const bool mipmaps = false, const unsigned nthreads = std::thread::hardware_concurrency());
+
+    auto get_width() const -> int { return levels[0].width; }
+    auto get_height() const -> int { return levels[0].height; }
+    auto get_format() const -> TGAImage::Format { return format; }
+    // 1 without mipmaps
+    auto nlevels() const -> int { return int(levels.size()); }
+
+    // Texel at (x, y) of a level, unchecked: all must be in range.
+    auto get(const int x, const int y, const int level = 0) const -> uint32_t {
+        const auto& l    = levels[level];
+        const auto& tile = tiles[l.first + (y / tile_size) * l.ntiles_x + x / tile_size];
+        return tile.texels[(y % tile_size) * tile_size + x % tile_size];
+    }
+    // Nearest texel of level 0 to (u, v) in texture coordinates, texel (x, y) covering [x, x + 1) / width x
+    // [y, y + 1) / height. Without branches, NaN samples the first texel.
+    template <Wrap wrap = Wrap::clamp, std::floating_point T>
+    auto sample(const T u, const T v) const -> uint32_t {
+        return get(texel<wrap>(u, get_width()), texel<wrap>(v, get_height()));
+    }
+    // Level of detail for texture coordinates that change by (dudx, dvdx) from one pixel to the next along x and by
+    // (dudy, dvdy) along y: log2 of the texels of level 0 a pixel spans along its longer side.
+    template <std::floating_point T>
+    auto lod(const T dudx, const T dvdx, const T dudy, const T dvdy) const -> T {
+        const auto w = T(get_width()), h = T(get_height());
+        const auto x = dudx * w * dudx * w + dvdx * h * dvdx * h;
+        const auto y = dudy * w * dudy * w + dvdy * h * dvdy * h;
+        return T(0.5) * std::log2(std::max(x, y));
+    }
+    // Trilinear sample at (u, v): the bilinearly filtered texels of the two levels around lod, blended. Levels of
+    // detail outside the chain take its first or last level, NaN the first.
+    template <Wrap wrap = Wrap::clamp, std::floating_point T>
+    auto sample(const T u, const T v, const T lod) const -> uint32_t {
+        const auto l  = clamp(lod, T(0), T(nlevels() - 1));
+        const auto l0 = int(l);
+        const auto l1 = std::min(l0 + 1, nlevels() - 1);
+        const auto t  = l - T(l0);
+
+        T c[4] = {};
+        bilinear<wrap>(l0, u, v, 1 - t, c);
+        bilinear<wrap>(l1, u, v, t, c);
+        auto texel = uint32_t(0);
+        for(auto k = 0; k < 4; k++) {
+            texel |= uint32_t(clamp(c[k] + T(0.5), T(0), T(255))) << (8 * k);
+        }
+        return texel;
+    }
+};
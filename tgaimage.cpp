@@ -1,9 +1,18 @@
 #include <algorithm>
+#include <bit>
 #include <cstdint>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <string.h>
+#include <thread>
+#include <vector>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "mappedfile.h"
 #include "tgaimage.h"
 
 TGAImage::TGAImage() : data{}, width(0), height(0), format(RGB) {}
@@ -26,110 +35,175 @@ TGAImage& TGAImage::operator=(const TGAImage& img) {
     return *this;
 }
 
+TGAImage::TGAImage(TGAImage&& img) noexcept : data(std::move(img.data)), width(img.width), height(img.height), format(img.format) {
+    img.data.clear();
+    img.width  = 0;
+    img.height = 0;
+}
+
+TGAImage& TGAImage::operator=(TGAImage&& img) noexcept {
+    if(this != &img) {
+        data   = std::move(img.data);
+        width  = img.width;
+        height = img.height;
+        format = img.format;
+        img.data.clear();
+        img.width  = 0;
+        img.height = 0;
+    }
+    return *this;
+}
+
 bool TGAImage::read_tga_file(const std::string filename) {
-    auto in = std::ifstream();
-    in.open(filename, std::ios::binary);
-    if(!in.is_open()) {
+    // the whole file is mapped and decoded in a single pass, which also flips it vertically
+    const auto file = MappedFile(filename);
+    if(!file.is_open()) {
         std::cerr << "can't open file " << filename << "\n";
-        in.close();
         return false;
     }
-    auto header = TGA_Header{};
-    in.read((char*)&header, sizeof(header));
-    if(!in.good()) {
-        in.close();
+    const auto in     = file.data();
+    auto       header = TGA_Header{};
+    if(in.size() < sizeof(header)) {
         std::cerr << "an error occured while reading the header\n";
         return false;
     }
-    width  = header.width;
-    height = header.height;
+    memcpy(&header, in.data(), sizeof(header));
+    width  = uint16_t(header.width);
+    height = uint16_t(header.height);
     format = Format(header.bitsperpixel >> 3);
     if(width <= 0 || height <= 0 || (format != GRAYSCALE && format != RGB && format != RGBA)) {
-        in.close();
         std::cerr << "bad bpp (or width/height) value\n";
         return false;
     }
-    const auto nbytes = width * height * format;
+    // the image id and the color map, if any, come before the pixels
+    const auto colormap = header.colormaptype ? size_t(uint16_t(header.colormaplength)) * ((uint8_t(header.colormapdepth) + 7) / 8) : 0;
+    const auto offset   = std::min(sizeof(header) + uint8_t(header.idlength) + colormap, in.size());
+    const auto pixels   = in.substr(offset);
+    const auto flip     = !(header.imagedescriptor & 0x20);
+    const auto nbytes   = width * height * format;
     data.resize(nbytes);
     if(3 == header.datatypecode || 2 == header.datatypecode) {
-        in.read((char*)data.data(), nbytes);
-        if(!in.good()) {
-            in.close();
+        if(pixels.size() < nbytes) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
+        const auto line = width * format;
+        for(auto y = 0uz; y < height; y++) {
+            memcpy(data.data() + (flip ? height - 1 - y : y) * line, pixels.data() + y * line, line);
+        }
     } else if(10 == header.datatypecode || 11 == header.datatypecode) {
-        if(!load_rle_data(in)) {
-            in.close();
+        if(!load_rle_data(pixels, flip)) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
     } else {
-        in.close();
         std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
         return false;
     }
-    if(!(header.imagedescriptor & 0x20)) {
-        flip_vertically();
-    }
     if(header.imagedescriptor & 0x10) {
         flip_horizontally();
     }
     std::cerr << width << "x" << height << "/" << format * 8 << "\n";
-    in.close();
     return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream& in) {
-    auto pixelcount   = width * height;
-    auto currentpixel = 0ul;
-    auto currentbyte  = 0ul;
-    auto colorbuffer  = TGAColor();
-    do {
-        auto chunkheader = in.get();
-        if(!in.good()) {
+namespace {
+// n copies of the pixel at src of bpp bytes at dst, the filled part doubled by every copy
+auto fill_pixels(uint8_t* dst, const uint8_t* src, const size_t bpp, const size_t n) -> void {
+    if(bpp == 1) {
+        memset(dst, *src, n);
+        return;
+    }
+    const auto total = n * bpp;
+    memcpy(dst, src, bpp);
+    for(auto done = bpp; done < total;) {
+        const auto k = std::min(done, total - done);
+        memcpy(dst + done, dst, k);
+        done += k;
+    }
+}
+} // namespace
+
+// Chunks may run over the end of a line; they are split there, so that every line lands where flip puts it.
+bool TGAImage::load_rle_data(const std::string_view in, const bool flip) {
+    const auto* p    = reinterpret_cast<const uint8_t*>(in.data());
+    const auto  line = width * format;
+    auto        pos  = 0uz;
+    auto        x    = 0uz; // next pixel, in the order of the file
+    auto        y    = 0uz;
+    while(y < height) {
+        if(pos >= in.size()) {
             std::cerr << "an error occured while reading the data\n";
             return false;
         }
-        if(chunkheader < 128) {
-            chunkheader++;
-            for(auto i = 0; i < chunkheader; i++) {
-                in.read((char*)colorbuffer.raw, format);
-                if(!in.good()) {
-                    std::cerr << "an error occured while reading the header\n";
-                    return false;
-                }
-                for(auto t = 0; t < format; t++)
-                    data[currentbyte++] = colorbuffer.raw[t];
-                currentpixel++;
-                if(currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
-            }
-        } else {
-            chunkheader -= 127;
-            in.read((char*)colorbuffer.raw, format);
-            if(!in.good()) {
-                std::cerr << "an error occured while reading the header\n";
-                return false;
+        const auto chunkheader = p[pos++];
+        const auto run         = chunkheader >= 128;
+        auto       n           = size_t(chunkheader & 0x7F) + 1;
+        const auto nbytes      = run ? size_t(format) : n * format;
+        if(in.size() - pos < nbytes) {
+            std::cerr << "an error occured while reading the data\n";
+            return false;
+        }
+        if(n > (height - y) * width - x) {
+            std::cerr << "Too many pixels read\n";
+            return false;
+        }
+        const auto* src = p + pos;
+        pos += nbytes;
+        while(n > 0) {
+            const auto k   = std::min(n, width - x);
+            auto*      dst = data.data() + (flip ? height - 1 - y : y) * line + x * format;
+            if(run) {
+                fill_pixels(dst, src, format, k);
+            } else {
+                memcpy(dst, src, k * format);
+                src += k * format;
             }
-            for(auto i = 0; i < chunkheader; i++) {
-                for(int t = 0; t < format; t++)
-                    data[currentbyte++] = colorbuffer.raw[t];
-                currentpixel++;
-                if(currentpixel > pixelcount) {
-                    std::cerr << "Too many pixels read\n";
-                    return false;
-                }
+            n -= k;
+            x += k;
+            if(x == width) {
+                x = 0;
+                y++;
             }
         }
-    } while(currentpixel < pixelcount);
+    }
     return true;
 }
 
-bool TGAImage::write_tga_file(const std::string filename, const bool rle) {
+namespace {
+auto same_pixel(const uint8_t* p, const size_t bpp, const size_t k) -> bool {
+    return memcmp(p + k * bpp, p + (k + 1) * bpp, bpp) == 0;
+}
+
+// Number of pixels k from first on, at most max, for which pixel k equals pixel k + 1 (equal) or differs from it
+// (!equal); stops at the last pixel, which has no successor. SSE2 compares the pixels of a 16-byte window with those
+// one pixel further at once.
+auto scan(const uint8_t* p, const size_t bpp, const size_t npixels, const size_t first, const size_t max, const bool equal) -> size_t {
+    const auto last = std::min(first + max, npixels - 1);
+    auto       k    = first;
+#ifdef __SSE2__
+    // the bits of sel are the first bytes of the pixels whose bpp bytes are all in the window
+    const auto sel   = bpp == 1 ? 0xFFFFu : bpp == 3 ? 0x1249u : 0x1111u;
+    const auto count = size_t(bpp == 1 ? 16 : bpp == 3 ? 5 : 4);
+    for(; k + count <= last && (k + 1) * bpp + 16 <= npixels * bpp; k += count) {
+        const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + k * bpp));
+        const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + (k + 1) * bpp));
+        auto       m = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)));
+        for(auto i = 1uz; i < bpp; i++) {
+            m &= m >> 1;
+        }
+        const auto stop = (equal ? ~m : m) & sel;
+        if(stop) return k + std::countr_zero(stop) / bpp - first;
+    }
+#endif
+    while(k < last && same_pixel(p, bpp, k) == equal) {
+        k++;
+    }
+    return k - first;
+}
+} // namespace
 
+bool TGAImage::write_tga_file(const std::string filename, const bool rle, const unsigned nthreads) {
     const auto developer_area_ref = std::array<uint8_t, 4>{0, 0, 0, 0};
     const auto extension_area_ref = std::array<uint8_t, 4>{0, 0, 0, 0};
     const auto footer             = std::string("TRUEVISION-XFILE.");
@@ -147,39 +221,19 @@ bool TGAImage::write_tga_file(const std::string filename, const bool rle) {
     header.height          = height;
     header.datatypecode    = (format == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2));
     header.imagedescriptor = 0x00; // top-left origin
-    out.write((char*)&header, sizeof(header));
-    if(!out.good()) {
-        out.close();
-        std::cerr << "can't dump the tga file\n";
-        return false;
-    }
+    // the whole file is built in memory and written at once
+    const auto* h     = reinterpret_cast<const uint8_t*>(&header);
+    auto        bytes = std::vector<uint8_t>(h, h + sizeof(header));
+    bytes.reserve(sizeof(header) + data.size() + height * ((width + 127) / 128) + developer_area_ref.size() + extension_area_ref.size() + footer.size() + 1);
     if(!rle) {
-        out.write((char*)data.data(), width * height * format);
-        if(!out.good()) {
-            std::cerr << "can't unload raw data\n";
-            out.close();
-            return false;
-        }
+        bytes.insert(bytes.end(), data.begin(), data.end());
     } else {
-        if(!unload_rle_data(out)) {
-            out.close();
-            std::cerr << "can't unload rle data\n";
-            return false;
-        }
+        unload_rle_data(bytes, nthreads);
     }
-    out.write(reinterpret_cast<const char*>(developer_area_ref.data()), developer_area_ref.size());
-    if(!out.good()) {
-        std::cerr << "can't dump the tga file\n";
-        out.close();
-        return false;
-    }
-    out.write(reinterpret_cast<const char*>(extension_area_ref.data()), extension_area_ref.size());
-    if(!out.good()) {
-        std::cerr << "can't dump the tga file\n";
-        out.close();
-        return false;
-    }
-    out.write(footer.c_str(), footer.size() + 1); // +1 for NULL
+    bytes.insert(bytes.end(), developer_area_ref.begin(), developer_area_ref.end());
+    bytes.insert(bytes.end(), extension_area_ref.begin(), extension_area_ref.end());
+    bytes.insert(bytes.end(), footer.c_str(), footer.c_str() + footer.size() + 1); // +1 for NULL
+    out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
     if(!out.good()) {
         std::cerr << "can't dump the tga file\n";
         out.close();
@@ -189,47 +243,77 @@ bool TGAImage::write_tga_file(const std::string filename, const bool rle) {
     return true;
 }
 
-// TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream& out) {
-    const auto max_chunk_length = uint8_t(128);
-    const auto npixels          = width * height;
-    auto       curpix           = 0uz;
-    while(curpix < npixels) {
-        auto chunkstart = curpix * format;
-        auto curbyte    = curpix * format;
-        auto run_length = uint8_t(1);
-        auto raw        = true;
-        while(curpix + run_length < npixels && run_length < max_chunk_length) {
-            auto succ_eq = true;
-            for(auto t = 0uz; succ_eq && t < format; t++) {
-                succ_eq = (data[curbyte + t] == data[curbyte + t + format]);
-            }
-            curbyte += format;
-            if(1 == run_length) {
-                raw = !succ_eq;
-            }
-            if(raw && succ_eq) {
-                run_length--;
-                break;
-            }
-            if(!raw && !succ_eq) {
-                break;
-            }
-            run_length++;
+namespace {
+// lines of images at least this large are encoded on several threads
+constexpr auto parallel_pixels = 1uz << 18;
+
+// Appends the chunks of a line of npixels pixels at p to q, returns the end of what it wrote.
+// Equal pixels at the start of a chunk make a run chunk. A raw chunk is only broken for a run where that saves bytes:
+// from two pixels on with three or four bytes per pixel, from three on for grayscale, where the run chunk and the header
+// of the raw chunk after it are no smaller than the two pixels.
+auto encode_line(const uint8_t* p, const size_t bpp, const size_t npixels, uint8_t* q) -> uint8_t* {
+    const auto max_chunk_length = 128uz;
+    const auto min_break_length = bpp == 1 ? 3uz : 2uz;
+    const auto run_length       = [&](const size_t k) { return 1 + scan(p, bpp, npixels, k, max_chunk_length - 1, true); };
+    for(auto curpix = 0uz; curpix < npixels;) {
+        const auto run = run_length(curpix);
+        if(run >= 2) {
+            *q++ = uint8_t(run + 127);
+            memcpy(q, p + curpix * bpp, bpp);
+            q += bpp;
+            curpix += run;
+            continue;
         }
-        curpix += run_length;
-        out.put(raw ? run_length - 1 : run_length + 127);
-        if(!out.good()) {
-            std::cerr << "can't dump the tga file\n";
-            return false;
+        // raw chunk up to the next run worth breaking it, which is only looked for before its last pixel
+        const auto limit = curpix + max_chunk_length - 1;
+        auto       end   = curpix + run;
+        auto       found = false;
+        while(!found && end < std::min(limit, npixels)) {
+            end += scan(p, bpp, npixels, end, limit - end, false);
+            if(end >= limit) break;
+            const auto r = run_length(end);
+            found        = r >= min_break_length;
+            if(!found) end += r;
         }
-        out.write((char*)(data.data() + chunkstart), (raw ? run_length * format : format));
-        if(!out.good()) {
-            std::cerr << "can't dump the tga file\n";
-            return false;
+        if(!found) end = std::min(curpix + max_chunk_length, npixels);
+        *q++ = uint8_t(end - curpix - 1);
+        memcpy(q, p + curpix * bpp, (end - curpix) * bpp);
+        q += (end - curpix) * bpp;
+        curpix = end;
+    }
+    return q;
+}
+} // namespace
+
+// Chunks end with their line, as the format recommends, so bands of lines are encoded independently and concatenated.
+void TGAImage::unload_rle_data(std::vector<uint8_t>& out, const unsigned nthreads) const {
+    const auto bpp        = size_t(format);
+    const auto line_bytes = width * bpp + (width + 127) / 128; // worst case, every chunk raw
+    const auto encode     = [&](const size_t y0, const size_t y1, std::vector<uint8_t>& bytes) {
+        const auto start = bytes.size();
+        bytes.resize(start + (y1 - y0) * line_bytes);
+        auto* q = bytes.data() + start;
+        for(auto y = y0; y < y1; y++) {
+            q = encode_line(data.data() + y * width * bpp, bpp, width, q);
         }
+        bytes.resize(q - bytes.data());
+    };
+    const auto n = width * height >= parallel_pixels ? std::min(size_t(std::max(nthreads, 1u)), height) : 1uz;
+    if(n == 1) {
+        encode(0, height, out);
+        return;
+    }
+    auto bands = std::vector<std::vector<uint8_t>>(n);
+    {
+        auto workers = std::vector<std::jthread>();
+        for(auto i = 1uz; i < n; i++) {
+            workers.emplace_back(encode, height * i / n, height * (i + 1) / n, std::ref(bands[i]));
+        }
+        encode(0, height / n, bands[0]);
+    }
+    for(const auto& band : bands) {
+        out.insert(out.end(), band.begin(), band.end());
     }
-    return true;
 }
 
 TGAColor TGAImage::get(int x, int y) const {
@@ -294,6 +378,10 @@ unsigned char* TGAImage::buffer() {
     return data.data();
 }
 
+const unsigned char* TGAImage::buffer() const {
+    return data.data();
+}
+
 void TGAImage::fill(const std::uint8_t v) {
     std::fill(data.begin(), data.end(), v);
 }
@@ -3,6 +3,8 @@
 
 #include <cstdint>
 #include <fstream>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 #pragma pack(push, 1)
@@ -68,6 +70,25 @@ struct TGAColor {
     }
 };
 
+// A color in the layout of TGAColor::raw without the pixel size: 4 bytes, copied with plain loads and stores. A pixel of
+// an image keeps its first get_format() bytes, see ImageView.
+struct PackedColor {
+    uint8_t b = 0;
+    uint8_t g = 0;
+    uint8_t r = 0;
+    uint8_t a = 0;
+
+    constexpr PackedColor() = default;
+    constexpr PackedColor(const uint8_t R, const uint8_t G, const uint8_t B, const uint8_t A) : b(B), g(G), r(R), a(A) {}
+    // from the bits of TGAColor::val, e.g. a Texture texel: b in the low byte
+    constexpr explicit PackedColor(const uint32_t bits) : b(uint8_t(bits)), g(uint8_t(bits >> 8)), r(uint8_t(bits >> 16)), a(uint8_t(bits >> 24)) {}
+    constexpr explicit PackedColor(const TGAColor& c) : b(c.raw[0]), g(c.raw[1]), r(c.raw[2]), a(c.raw[3]) {}
+
+    constexpr auto bits() const -> uint32_t { return b | uint32_t(g) << 8 | uint32_t(r) << 16 | uint32_t(a) << 24; }
+    auto operator==(const PackedColor&) const -> bool = default;
+};
+static_assert(sizeof(PackedColor) == 4 && std::is_trivially_copyable_v<PackedColor>);
+
 class TGAImage {
   public:
     enum Format {
@@ -79,21 +100,25 @@ class TGAImage {
     TGAImage();
     TGAImage(const size_t w, const size_t h, const Format bpp);
     TGAImage(const TGAImage& img);
+    TGAImage(TGAImage&& img) noexcept; // leaves img empty
     bool     read_tga_file(const std::string filename);
-    bool     write_tga_file(const std::string filename, const bool rle = true);
+    // RLE encoding runs on up to nthreads threads, with the same output for any number of them.
+    bool     write_tga_file(const std::string filename, const bool rle = true, const unsigned nthreads = 1);
     bool     flip_horizontally();
     bool     flip_vertically();
     bool     scale(int w, int h);
     TGAColor get(int x, int y) const;
     bool     set(int x, int y, TGAColor c);
     ~TGAImage() = default;
-    TGAImage& operator=(const TGAImage& img);
-    size_t    get_width() const;
-    size_t    get_height() const;
-    Format    get_format() const;
-    uint8_t*  buffer();
-    void      fill(const uint8_t v);
-    void      clear();
+    TGAImage&      operator=(const TGAImage& img);
+    TGAImage&      operator=(TGAImage&& img) noexcept;
+    size_t         get_width() const;
+    size_t         get_height() const;
+    Format         get_format() const;
+    uint8_t*       buffer();
+    const uint8_t* buffer() const;
+    void           fill(const uint8_t v);
+    void           clear();
 
   private:
     std::vector<uint8_t> data;
@@ -101,8 +126,8 @@ class TGAImage {
     size_t               height;
     Format               format;
 
-    bool load_rle_data(std::ifstream& in);
-    bool unload_rle_data(std::ofstream& out);
+    bool load_rle_data(const std::string_view in, const bool flip);
+    void unload_rle_data(std::vector<uint8_t>& out, const unsigned nthreads) const;
 };
 
 #endif //__IMAGE_H__
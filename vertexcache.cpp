@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "vertexcache.h"
+
+auto acmr(const std::span<const int> indices, const int cache_size) -> double {
+    if(indices.size() < 3) return 0;
+    const auto nverts = size_t(std::ranges::max(indices)) + 1;
+    // a vertex is still cached if fewer than cache_size others entered the FIFO after it
+    auto entered = std::vector<int64_t>(nverts, INT64_MIN / 2);
+    auto misses  = int64_t(0);
+    for(const auto v : indices) {
+        if(misses - entered[v] < cache_size) continue;
+        entered[v] = misses++;
+    }
+    return double(misses) / double(indices.size() / 3);
+}
+
+auto tipsify(const std::span<int> indices, const size_t nverts, const int cache_size) -> void {
+    const auto ntris = indices.size() / 3;
+    // triangles around every vertex
+    auto first = std::vector<int>(nverts + 1, 0);
+    for(auto i = 0uz; i < ntris * 3; i++) {
+        first[indices[i] + 1]++;
+    }
+    for(auto v = 0uz; v < nverts; v++) {
+        first[v + 1] += first[v];
+    }
+    auto adjacency = std::vector<int>(first.back());
+    auto fill      = std::vector<int>(first.begin(), first.end() - 1);
+    for(auto i = 0uz; i < ntris * 3; i++) {
+        adjacency[fill[indices[i]]++] = int(i / 3);
+    }
+
+    auto live      = std::vector<int>(nverts); // triangles around the vertex still to emit
+    auto stamp     = std::vector<int>(nverts, 0);
+    auto emitted   = std::vector<bool>(ntris, false);
+    auto dead_end  = std::vector<int>();
+    auto order     = std::vector<int>();
+    auto candidate = std::vector<int>();
+    for(auto v = 0uz; v < nverts; v++) {
+        live[v] = first[v + 1] - first[v];
+    }
+    order.reserve(ntris);
+    auto time   = cache_size + 1; // a vertex is cached while time - stamp <= cache_size
+    auto cursor = 0uz;
+    // next vertex with triangles left when the fan around the current one is done
+    const auto skip_dead_end = [&] {
+        while(!dead_end.empty()) {
+            const auto v = dead_end.back();
+            dead_end.pop_back();
+            if(live[v] > 0) return v;
+        }
+        for(; cursor < nverts; cursor++) {
+            if(live[cursor] > 0) return int(cursor);
+        }
+        return -1;
+    };
+
+    for(auto fan = skip_dead_end(); fan >= 0;) {
+        candidate.clear();
+        for(auto k = first[fan]; k < first[fan + 1]; k++) {
+            const auto t = adjacency[k];
+            if(emitted[t]) continue;
+            for(auto j = 0; j < 3; j++) {
+                const auto v = indices[t * 3 + j];
+                dead_end.push_back(v);
+                candidate.push_back(v);
+                live[v]--;
+                if(time - stamp[v] > cache_size) stamp[v] = time++;
+            }
+            emitted[t] = true;
+            order.push_back(t);
+        }
+        // the candidate that is still cached after its remaining triangles went through the cache, the oldest first
+        auto best = -1, best_priority = -1;
+        for(const auto v : candidate) {
+            if(live[v] == 0) continue;
+            const auto age      = time - stamp[v];
+            const auto priority = age + 2 * live[v] <= cache_size ? age : 0;
+            if(priority > best_priority) {
+                best          = v;
+                best_priority = priority;
+            }
+        }
+        fan = best >= 0 ? best : skip_dead_end();
+    }
+
+    const auto original = std::vector<int>(indices.begin(), indices.begin() + ntris * 3);
+    for(auto i = 0uz; i < ntris; i++) {
+        std::copy_n(original.begin() + order[i] * 3, 3, indices.begin() + i * 3);
+    }
+}
+
+auto renumber_by_first_use(const std::span<int> indices, const size_t nverts) -> std::vector<int> {
+    auto renumbered = std::vector<int>(nverts, -1);
+    auto old        = std::vector<int>();
+    old.reserve(nverts);
+    for(auto& v : indices) {
+        if(renumbered[v] < 0) {
+            renumbered[v] = int(old.size());
+            old.push_back(v);
+        }
+        v = renumbered[v];
+    }
+    return old;
+}
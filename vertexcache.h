@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+// Post-transform vertex cache: the last vertex_cache_size transformed vertices, first in first out.
+constexpr auto vertex_cache_size = 16;
+
+// Average cache miss ratio: vertices transformed per triangle when the triangles are drawn in the order of the index
+// buffer (three indices per triangle). 3 with no reuse at all, about 0.5 at best for a regular mesh.
+auto acmr(std::span<const int> indices, const int cache_size = vertex_cache_size) -> double;
+
+// Reorders the triangles for a cache of cache_size vertices with Tipsify (Sander, Nehab and Barczak 2007),
+// a greedy fan around the most recently used vertex. Indices must be in [0, nverts).
+auto tipsify(std::span<int> indices, const size_t nverts, const int cache_size = vertex_cache_size) -> void;
+
+// Renumbers the vertices in the order the triangles first use them, so that vertex fetches go forward through memory.
+// Returns the old index of every new vertex.
+auto renumber_by_first_use(std::span<int> indices, const size_t nverts) -> std::vector<int>;
@@ -1,4 +1,5 @@
 #include <chrono>
+#include <optional>
 #include <print>
 
 #include <GL/gl.h>
@@ -15,7 +16,13 @@ auto last_x      = 3.0;
 auto last_y      = 0.0;
 auto eye         = Vec3d(last_x, last_y, 3);
 auto is_dragging = false;
+auto picked      = std::optional<Vec2d>(); // cursor position of a right click, to look up after the next frame
 void mouse_button_callback(GLFWwindow* window, int button, int action, int /* mods */) {
+    if(button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS) {
+        auto x = 0.0, y = 0.0;
+        glfwGetCursorPos(window, &x, &y);
+        picked = Vec2d(x, y);
+    }
     if(button == GLFW_MOUSE_BUTTON_LEFT) {
         if(action == GLFW_PRESS) {
             is_dragging = true;
@@ -80,11 +87,12 @@ auto main(const int argc, const char* argv[]) -> int {
     }
 
     auto image   = TGAImage(width, height, TGAImage::RGBA);
-    auto zbuffer = std::vector<double>(width * height, std::numeric_limits<double>::max());
-    auto model   = Model(argv[1]);
+    auto zbuffer = gl::DepthBuffer(width, height);
+    auto model   = Model(argv[1], TriangleOrder::tipsify);
     if(!model.load_diffusemap(argv[1])) {
         return 1;
     }
+    model.build_bvh();
 
     if(glfwInit() == GL_FALSE) {
         std::println(stderr, "failed to init glfw");
@@ -130,7 +138,7 @@ auto main(const int argc, const char* argv[]) -> int {
     auto frame_count = 0;
     auto fps_counter = FPS_Counter();
     while(glfwWindowShouldClose(window) == GL_FALSE) {
-        std::fill(zbuffer.begin(), zbuffer.end(), std::numeric_limits<double>::max());
+        zbuffer.clear();
         image.fill(0);
         fps_counter.update();
         timer.now();
@@ -138,6 +146,16 @@ auto main(const int argc, const char* argv[]) -> int {
         std::fflush(stdout);
         frame_count++;
         paint_diffuse_texture_with_eye<gl::Shader>(eye, zbuffer, image, model, width, height);
+        if(picked) {
+            // the image is shown bottom row first, the cursor counts rows from the top
+            const auto hit = intersect(model.bvh(), model.vertices(), model.indices(), gl::pick_ray(picked->x, height - picked->y));
+            if(hit) {
+                std::println("\npicked face {} at ({:.3f}, {:.3f}, {:.3f})", hit->face, hit->point.x, hit->point.y, hit->point.z);
+            } else {
+                std::println("\npicked nothing");
+            }
+            picked.reset();
+        }
 
         glTexImage2D(GL_TEXTURE_2D, 0, internal_format, image.get_width(), image.get_height(), 0, format, GL_UNSIGNED_BYTE, image.buffer());
         glClear(GL_COLOR_BUFFER_BIT);